@@ -1,5 +1,28 @@
 #include "quickjs_cpp.hpp"
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <set>
+#include <fstream>
+#include <filesystem>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#endif
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 #define JS_ATOM_NULL 0
 
@@ -30,34 +53,51 @@ void js_quickjs::throw_exception(JSContext* ctx, JSValue val, const std::string&
     throw std::runtime_error("Exception (" + data + "): " + err);
 }
 
-///todo: this seems pretty uh. bad. If the value gets freed, this will be ub everywhere
-uint64_t value_to_key(const js_quickjs::value& root)
-{
-    void* ptr = root.val.u.ptr;
-
-    uint64_t as_val = 0;
-    memcpy(&as_val, &ptr, sizeof(ptr));
-
-    return as_val;
-}
-
-uint64_t value_to_key(const JSValue& root)
-{
-    void* ptr = root.u.ptr;
-
-    uint64_t as_val = 0;
-    memcpy(&as_val, &ptr, sizeof(ptr));
-
-    return as_val;
-}
-
+///hidden values live in a WeakMap of owner -> null prototype holder object, so the engine traces
+///them like any other value and drops them when the owner is collected
+///a hidden value that references its own owner keeps the owner alive, as the map holds values strongly
 struct heap_stash
 {
     void* sandbox = nullptr;
     JSValue heap_stash_value;
+    JSValue hidden_store = JS_UNDEFINED;
+    ///captured before any user code runs, so replacing WeakMap or patching its prototype can't see or break hidden values
+    JSValue weakmap_ctor = JS_UNDEFINED;
+    JSValue weakmap_get = JS_UNDEFINED;
+    JSValue weakmap_set = JS_UNDEFINED;
     JSContext* ctx = nullptr;
-    std::map<uint64_t, std::map<std::string, JSValue>> hidden_map;
-    std::map<uint64_t, std::pair<JSValue, uint64_t>> reference_count;
+    JSInterruptHandler* user_interrupt = nullptr;
+    ///shared with completion tokens, which may outlive the runtime
+    std::shared_ptr<js_quickjs::completion_queue> completions = std::make_shared<js_quickjs::completion_queue>();
+    ///resolve, reject pairs of async promises by token id
+    std::map<int64_t, std::pair<JSValue, JSValue>> pending_async;
+    int64_t next_async_id = 0;
+    js_quickjs::event_loop* loop = nullptr;
+    js_quickjs::job_stats jobs;
+    ///coroutines suspended on a promise_watcher, keyed by the id stored in the watcher's state
+    std::map<int64_t, void*> promise_waiters;
+    ///ids whose promise has settled, resumed by execute_jobs
+    std::vector<int64_t> ready_waiters;
+    int64_t next_waiter_id = 0;
+    ///looked up on every array conversion, so it's kept out of the compactable intern table
+    JSAtom length_atom = JS_ATOM_NULL;
+    ///field name atoms for reflected types, keyed by a per type tag address
+    std::map<const void*, std::vector<JSAtom>> reflected_atoms;
+
+    struct interned_atom
+    {
+        JSAtom atom = 0;
+        ///second chance bit, set on use and cleared by a compaction slice
+        bool referenced = true;
+    };
+
+    std::map<std::string, interned_atom, std::less<>> interned_atoms;
+
+    ///compaction sweeps the intern table a slice at a time, resuming after compact_cursor
+    std::string compact_cursor;
+    bool compact_in_pass = false;
+    size_t auto_compact_budget = 0;
+    js_quickjs::heap_compact_stats compact_stats;
 
     heap_stash(JSContext* global, void* _sandbox)
     {
@@ -69,91 +109,232 @@ struct heap_stash
             js_quickjs::throw_exception(global, test);
 
         heap_stash_value = test;
+
+        length_atom = JS_NewAtom(global, "length");
+
+        if(length_atom == JS_ATOM_NULL)
+            throw std::runtime_error("Could not allocate atom");
+
+        capture_weakmap();
+        create_hidden_store();
     }
 
     ~heap_stash()
     {
         JS_FreeValue(ctx, heap_stash_value);
+        JS_FreeValue(ctx, hidden_store);
+        JS_FreeValue(ctx, weakmap_ctor);
+        JS_FreeValue(ctx, weakmap_get);
+        JS_FreeValue(ctx, weakmap_set);
+        JS_FreeAtom(ctx, length_atom);
 
-        for(auto& i : hidden_map)
+        for(auto& [id, funcs] : pending_async)
         {
-            for(auto& j : i.second)
-            {
-                JS_FreeValue(ctx, j.second);
-            }
+            JS_FreeValue(ctx, funcs.first);
+            JS_FreeValue(ctx, funcs.second);
         }
 
-        for(auto& i : reference_count)
+        for(auto& [tag, atoms] : reflected_atoms)
         {
-            std::pair<JSValue, uint64_t>& entry = i.second;
+            for(JSAtom atom : atoms)
+                JS_FreeAtom(ctx, atom);
+        }
 
-            for(int kk=0; kk < (int)entry.second; kk++)
-            {
-                JS_FreeValue(ctx, entry.first);
-            }
+        for(auto& i : interned_atoms)
+        {
+            JS_FreeAtom(ctx, i.second.atom);
         }
     }
 
-    void add_ref(JSValue val)
+    ///must run on a fresh context, before any user code
+    void capture_weakmap()
     {
-        uint64_t key = value_to_key(val);
+        JSValue glob = JS_GetGlobalObject(ctx);
+        JSValue ctor = JS_GetPropertyStr(ctx, glob, "WeakMap");
 
-        reference_count[key].first = JS_DupValue(ctx, val);
-        reference_count[key].second++;
-    }
+        JS_FreeValue(ctx, glob);
 
-    void remove_ref(JSValue val)
-    {
-        uint64_t key = value_to_key(val);
+        if(JS_IsException(ctor))
+            js_quickjs::throw_exception(ctx, ctor);
 
-        std::pair<JSValue, uint64_t>& entry = reference_count[key];
+        JSValue proto = JS_GetPropertyStr(ctx, ctor, "prototype");
 
-        if(JS_VALUE_HAS_REF_COUNT(val))
+        if(JS_IsException(proto))
         {
-            JSRefCountHeader *p = (JSRefCountHeader *)JS_VALUE_GET_PTR(val);
+            JS_FreeValue(ctx, ctor);
+            js_quickjs::throw_exception(ctx, proto);
+        }
 
-            if(p->ref_count <= (int)entry.second)
-            {
-                for(int kk=0; kk < (int)entry.second; kk++)
-                {
-                    JS_FreeValue(ctx, val);
-                }
+        weakmap_ctor = ctor;
+        weakmap_get = JS_GetPropertyStr(ctx, proto, "get");
+        weakmap_set = JS_GetPropertyStr(ctx, proto, "set");
 
-                entry.second = 0;
+        JS_FreeValue(ctx, proto);
 
-                for(auto& i : hidden_map[key])
-                {
-                    JS_FreeValue(ctx, i.second);
-                }
+        if(!JS_IsFunction(ctx, weakmap_get) || !JS_IsFunction(ctx, weakmap_set))
+            throw std::runtime_error("Could not capture WeakMap intrinsics");
+    }
 
-                hidden_map[key].clear();
-            }
-        }
+    void create_hidden_store()
+    {
+        JSValue store = JS_CallConstructor(ctx, weakmap_ctor, 0, nullptr);
+
+        if(JS_IsException(store))
+            js_quickjs::throw_exception(ctx, store);
+
+        JS_FreeValue(ctx, hidden_store);
+        hidden_store = store;
     }
 
-    void compact()
+    ///the returned atom is owned by the table
+    JSAtom intern(std::string_view name)
     {
-        for(auto& i : reference_count)
+        if(auto it = interned_atoms.find(name); it != interned_atoms.end())
         {
-            remove_ref(i.second.first);
+            it->second.referenced = true;
+            return it->second.atom;
         }
 
-        for(auto it = reference_count.begin(); it != reference_count.end();)
+        JSAtom atom = JS_NewAtomLen(ctx, name.data(), name.size());
+
+        if(atom == JS_ATOM_NULL)
+            throw std::runtime_error("Could not allocate atom");
+
+        interned_atoms.emplace(std::string(name), interned_atom{atom, true});
+
+        return atom;
+    }
+
+    ///visits at most budget intern entries. Entries that haven't been used since the last visit are
+    ///released, keys hold their own reference so this never invalidates a live key
+    ///returns true if the current pass has entries left
+    bool compact_slice(size_t budget)
+    {
+        auto it = compact_in_pass ? interned_atoms.upper_bound(compact_cursor) : interned_atoms.begin();
+
+        compact_in_pass = true;
+
+        size_t scanned = 0;
+        size_t freed = 0;
+
+        while(it != interned_atoms.end() && scanned < budget)
         {
-            if(it->second.second == 0)
-            {
-                if(auto map_it = hidden_map.find(it->first); map_it != hidden_map.end())
-                {
-                    hidden_map.erase(map_it);
-                }
+            scanned++;
 
-                it = reference_count.erase(it);
-            }
-            else
+            if(it->second.referenced)
             {
+                it->second.referenced = false;
                 it++;
+                continue;
             }
+
+            JS_FreeAtom(ctx, it->second.atom);
+            it = interned_atoms.erase(it);
+            freed++;
+        }
+
+        bool remaining = it != interned_atoms.end();
+
+        if(remaining && it == interned_atoms.begin())
+        {
+            compact_in_pass = false;
+        }
+        else if(remaining)
+        {
+            compact_cursor = std::prev(it)->first;
+        }
+        else
+        {
+            compact_cursor.clear();
+            compact_in_pass = false;
+            compact_stats.passes++;
+        }
+
+        compact_stats.slices++;
+        compact_stats.entries_scanned += scanned;
+        compact_stats.entries_freed += freed;
+        compact_stats.last_slice_scanned = scanned;
+        compact_stats.last_slice_freed = freed;
+        compact_stats.entries = interned_atoms.size();
+
+        return remaining;
+    }
+
+    ///drops every hidden value and the heap stash object
+    void clear()
+    {
+        create_hidden_store();
+
+        JSValue next = JS_NewObject(ctx);
+
+        if(JS_IsException(next))
+            js_quickjs::throw_exception(ctx, next);
+
+        JS_FreeValue(ctx, heap_stash_value);
+        heap_stash_value = next;
+    }
+
+    ///moves the stash onto a fresh context on the same runtime. Everything created in the old context is
+    ///released while it's still alive, the atom tables are runtime wide and carry over
+    void rebind(JSContext* next)
+    {
+        JS_FreeValue(ctx, heap_stash_value);
+        JS_FreeValue(ctx, hidden_store);
+        JS_FreeValue(ctx, weakmap_ctor);
+        JS_FreeValue(ctx, weakmap_get);
+        JS_FreeValue(ctx, weakmap_set);
+
+        heap_stash_value = JS_UNDEFINED;
+        hidden_store = JS_UNDEFINED;
+        weakmap_ctor = JS_UNDEFINED;
+        weakmap_get = JS_UNDEFINED;
+        weakmap_set = JS_UNDEFINED;
+
+        ctx = next;
+
+        capture_weakmap();
+        clear();
+    }
+
+    ///finishes the current pass in one go, then runs the cycle collector so owners caught in cycles are
+    ///collected and their holders dropped. A hidden value that refers back to its own owner is held strongly
+    ///by the map and keeps both alive until clear()
+    void compact()
+    {
+        while(compact_slice(interned_atoms.size() + 1)){}
+
+        JS_RunGC(JS_GetRuntime(ctx));
+    }
+
+    ///returns undefined if there's no holder and create is false
+    JSValue get_holder(JSValueConst owner, bool create)
+    {
+        JSValue found = JS_Call(ctx, weakmap_get, hidden_store, 1, &owner);
+
+        if(JS_IsException(found))
+            js_quickjs::throw_exception(ctx, found);
+
+        if(!JS_IsUndefined(found) || !create)
+            return found;
+
+        JSValue holder = JS_NewObjectProto(ctx, JS_NULL);
+
+        if(JS_IsException(holder))
+            js_quickjs::throw_exception(ctx, holder);
+
+        JSValue args[2] = {owner, holder};
+
+        JSValue ret = JS_Call(ctx, weakmap_set, hidden_store, 2, args);
+
+        if(JS_IsException(ret))
+        {
+            JS_FreeValue(ctx, holder);
+            js_quickjs::throw_exception(ctx, ret);
         }
+
+        JS_FreeValue(ctx, ret);
+
+        return holder;
     }
 
     void add_hidden(const js_quickjs::value& root, const std::string& key, const js_quickjs::value& val)
@@ -161,90 +342,188 @@ struct heap_stash
         if(!root.is_function() && !root.is_object())
             throw std::runtime_error("Must be function or array");
 
-        uint64_t rkey = value_to_key(root);
+        JSValue holder = get_holder(root.val, true);
+
+        JSAtom atom = JS_NewAtomLen(ctx, key.c_str(), key.size());
+
+        if(atom == JS_ATOM_NULL)
+        {
+            JS_FreeValue(ctx, holder);
+            throw std::runtime_error("Could not allocate atom");
+        }
 
-        JSValue dup = JS_DupValue(root.ctx, val.val);
+        [[maybe_unused]] int present = JS_HasProperty(ctx, holder, atom);
 
-        assert(hidden_map[rkey].find(key) == hidden_map[rkey].end());
+        assert(present == 0);
 
-        hidden_map[rkey].emplace(key, dup);
+        JS_DefinePropertyValue(ctx, holder, atom, JS_DupValue(ctx, val.val), JS_PROP_C_W_E);
 
-        add_ref(root.val);
+        JS_FreeAtom(ctx, atom);
+        JS_FreeValue(ctx, holder);
     }
 
     bool has_hidden(const js_quickjs::value& root, const std::string& key)
     {
-        uint64_t rkey = value_to_key(root);
+        if(!JS_IsObject(root.val))
+            return false;
 
-        auto it = hidden_map.find(rkey);
+        JSValue holder = get_holder(root.val, false);
 
-        if(it == hidden_map.end())
+        if(JS_IsUndefined(holder))
             return false;
 
-        auto it2 = it->second.find(key);
+        JSAtom atom = JS_NewAtomLen(ctx, key.c_str(), key.size());
 
-        if(it2 == it->second.end())
-            return false;
+        if(atom == JS_ATOM_NULL)
+        {
+            JS_FreeValue(ctx, holder);
+            throw std::runtime_error("Could not allocate atom");
+        }
 
-        return true;
+        bool found = JS_HasProperty(ctx, holder, atom) > 0;
+
+        JS_FreeAtom(ctx, atom);
+        JS_FreeValue(ctx, holder);
+
+        return found;
     }
 
     js_quickjs::value get_hidden(const js_quickjs::value& root, const std::string& key)
     {
-        uint64_t rkey = value_to_key(root);
-
-        auto it = hidden_map.find(rkey);
+        JSValue holder = get_holder(root.val, false);
 
-        if(it == hidden_map.end())
+        if(JS_IsUndefined(holder))
             throw std::runtime_error("No root in get_hidden");
 
-        auto it2 = it->second.find(key);
-
-        if(it2 == it->second.end())
-            throw std::runtime_error("No key in get_hidden");
+        JSAtom atom = JS_NewAtomLen(ctx, key.c_str(), key.size());
 
-        js_quickjs::value val(*root.vctx);
-        val = it2->second;
-        return val;
-    }
+        if(atom == JS_ATOM_NULL)
+        {
+            JS_FreeValue(ctx, holder);
+            throw std::runtime_error("Could not allocate atom");
+        }
 
-    /*void remove_hidden(const js_quickjs::value& root, const std::string& key)
-    {
-        uint64_t rkey = value_to_key(root);
+        if(JS_HasProperty(ctx, holder, atom) <= 0)
+        {
+            JS_FreeAtom(ctx, atom);
+            JS_FreeValue(ctx, holder);
+            throw std::runtime_error("No key in get_hidden");
+        }
 
-        auto it = hidden_map.find(rkey);
+        JSValue found = JS_GetProperty(ctx, holder, atom);
 
-        if(it == hidden_map.end())
-            return;
+        JS_FreeAtom(ctx, atom);
+        JS_FreeValue(ctx, holder);
 
-        auto it2 = it->second.find(key);
+        if(JS_IsException(found))
+            js_quickjs::throw_exception(ctx, found);
 
-        if(it2 == it->second.end())
-            return;
+        js_quickjs::value val(*root.vctx);
+        val = found;
 
-        JS_FreeValue(root.ctx, it2->second);
+        JS_FreeValue(ctx, found);
 
-        it->second.erase(it2);
-    }*/
+        return val;
+    }
 };
 
 struct global_stash
 {
     JSValue global_stash_value;
     JSContext* ctx = nullptr;
+    ///captured with boxed_primitives, so a tenant replacing Float32Array and friends can't intercept conversions
+    std::map<std::string, JSValue, std::less<>> typed_array_ctors;
+    ///export tables for native modules, read when quickjs instantiates the module
+    std::map<JSModuleDef*, std::pair<const JSCFunctionListEntry*, size_t>> native_modules;
+
+    ///Number, String and Boolean with their prototype's valueOf, captured before any user code runs
+    std::vector<std::pair<JSValue, JSValue>> boxed_primitives;
+
+    ///captured alongside boxed_primitives, so patching Promise.prototype.then can't intercept a promise_watcher
+    JSValue promise_ctor = JS_UNDEFINED;
+    JSValue promise_resolve = JS_UNDEFINED;
+    JSValue promise_then = JS_UNDEFINED;
 
     global_stash(JSContext* _ctx)
     {
         ctx = _ctx;
         global_stash_value = JS_NewObject(ctx);
+
+        JSValue glob = JS_GetGlobalObject(ctx);
+
+        for(const char* name : {"Number", "String", "Boolean"})
+        {
+            JSValue ctor = JS_GetPropertyStr(ctx, glob, name);
+            JSValue proto = JS_GetPropertyStr(ctx, ctor, "prototype");
+            JSValue value_of = JS_GetPropertyStr(ctx, proto, "valueOf");
+
+            JS_FreeValue(ctx, proto);
+
+            boxed_primitives.push_back({ctor, value_of});
+        }
+
+        for(const char* name : {"Int8Array", "Uint8Array", "Int16Array", "Uint16Array", "Int32Array", "Uint32Array",
+                                "BigInt64Array", "BigUint64Array", "Float32Array", "Float64Array"})
+        {
+            typed_array_ctors.emplace(name, JS_GetPropertyStr(ctx, glob, name));
+        }
+
+        promise_ctor = JS_GetPropertyStr(ctx, glob, "Promise");
+        promise_resolve = JS_GetPropertyStr(ctx, promise_ctor, "resolve");
+
+        JSValue promise_proto = JS_GetPropertyStr(ctx, promise_ctor, "prototype");
+        promise_then = JS_GetPropertyStr(ctx, promise_proto, "then");
+        JS_FreeValue(ctx, promise_proto);
+
+        JS_FreeValue(ctx, glob);
     }
 
     ~global_stash()
     {
         JS_FreeValue(ctx, global_stash_value);
+
+        for(auto& [ctor, value_of] : boxed_primitives)
+        {
+            JS_FreeValue(ctx, ctor);
+            JS_FreeValue(ctx, value_of);
+        }
+
+        for(auto& i : typed_array_ctors)
+        {
+            JS_FreeValue(ctx, i.second);
+        }
+
+        JS_FreeValue(ctx, promise_ctor);
+        JS_FreeValue(ctx, promise_resolve);
+        JS_FreeValue(ctx, promise_then);
+    }
+
+    JSValue get_typed_array_ctor(std::string_view name)
+    {
+        auto it = typed_array_ctors.find(name);
+
+        if(it == typed_array_ctors.end())
+            return JS_ThrowTypeError(ctx, "Unknown typed array %s", std::string(name).c_str());
+
+        return JS_DupValue(ctx, it->second);
     }
 };
 
+///the engine calls this periodically while running script, which makes it a convenient place
+///to do bounded background work before handing over to the user's handler
+int heap_interrupt(JSRuntime* rt, void* opaque)
+{
+    heap_stash* heap = (heap_stash*)opaque;
+
+    if(heap->auto_compact_budget > 0)
+        heap->compact_slice(heap->auto_compact_budget);
+
+    if(heap->user_interrupt)
+        return heap->user_interrupt(rt, heap->sandbox);
+
+    return 0;
+}
+
 void init_heap(JSContext* root, JSInterruptHandler interrupt, void* sandbox)
 {
     heap_stash* heap = new heap_stash(root, sandbox);
@@ -253,8 +532,10 @@ void init_heap(JSContext* root, JSInterruptHandler interrupt, void* sandbox)
     JS_SetContextOpaque(root, (void*)stash);
     JS_SetRuntimeOpaque(JS_GetRuntime(root), (void*)heap);
 
+    heap->user_interrupt = interrupt;
+
     if(interrupt)
-        JS_SetInterruptHandler(JS_GetRuntime(root), interrupt, heap->sandbox);
+        JS_SetInterruptHandler(JS_GetRuntime(root), heap_interrupt, heap);
 
     JS_SetCanBlock(JS_GetRuntime(root), false);
 }
@@ -310,6 +591,9 @@ js_quickjs::value_context::~value_context()
         {
             heap_stash* heaps = (heap_stash*)JS_GetRuntimeOpaque(heap);
 
+            ///their watchers would free state into a dead runtime when the coroutine is destroyed later
+            assert(heaps == nullptr || heaps->promise_waiters.empty());
+
             delete heaps;
         }
 
@@ -334,6 +618,11 @@ void js_quickjs::value_context::push_this(const value& val)
     this_stack.push_back(val);
 }
 
+void js_quickjs::value_context::push_this(value&& val)
+{
+    this_stack.push_back(std::move(val));
+}
+
 void js_quickjs::value_context::pop_this()
 {
     assert(this_stack.size() > 0);
@@ -352,1405 +641,5424 @@ js_quickjs::value js_quickjs::value_context::get_current_this()
     return val;
 }
 
-void js_quickjs::value_context::execute_jobs()
+///rejects with message, for completions that failed on the worker or couldn't be converted here
+static JSValue make_completion_error(JSContext* ctx, const std::string& message)
 {
-    JSContext* pending = nullptr;
-
-    while(JS_ExecutePendingJob(heap, &pending) > 0)
-    {
+    JSValue err = JS_NewError(ctx);
+    JS_DefinePropertyValueStr(ctx, err, "message", JS_NewStringLen(ctx, message.c_str(), message.size()), JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
 
-    }
+    return err;
 }
 
-void js_quickjs::value_context::compact_heap_stash()
+///settles the promises of every async result that's arrived, returns false if there were none
+///a completion whose value can't be converted rejects its promise rather than stalling the rest
+static bool deliver_completions(js_quickjs::value_context& vctx, heap_stash* stash)
 {
-    heap_stash* stash = get_heap_stash(ctx);
+    std::vector<js_quickjs::completion*> done = stash->completions->take_all();
 
-    stash->compact();
-}
+    for(js_quickjs::completion* c : done)
+    {
+        std::unique_ptr<js_quickjs::completion> owned(c);
 
-void js_quickjs::value_context::execute_timeout_check()
-{
-    JSInterruptHandler* handler = JS_GetInterruptHandler(heap);
+        auto it = stash->pending_async.find(c->id);
 
-    if(handler != nullptr)
-    {
-        ///todo: handle return values
-        int ret = handler(heap, JS_GetInterruptHandlerOpaque(heap));
+        if(it == stash->pending_async.end())
+            continue;
 
-        (void)ret;
-    }
-}
+        auto [resolve, reject] = it->second;
 
-js_quickjs::value::value(const js_quickjs::value& other)
-{
-    vctx = other.vctx;
-    ctx = other.ctx;
+        stash->pending_async.erase(it);
 
-    val = JS_DupValue(other.ctx, other.val);
-    has_value = true;
+        bool success = c->success;
+        JSValue arg = JS_UNDEFINED;
 
-    if(other.has_parent)
-    {
-        has_parent = true;
-        parent_value = JS_DupValue(other.ctx, other.parent_value);
-        indices = other.indices;
-    }
-}
+        if(success)
+        {
+            try
+            {
+                arg = c->make_value ? c->make_value(vctx.ctx) : JS_UNDEFINED;
+            }
+            catch(std::exception& e)
+            {
+                success = false;
+                c->error = e.what();
+            }
+            catch(...)
+            {
+                success = false;
+                c->error = "Could not convert async result";
+            }
+        }
 
-js_quickjs::value::value(js_quickjs::value_context& _vctx)
-{
-    vctx = &_vctx;
-    ctx = vctx->ctx;
+        if(!success)
+            arg = make_completion_error(vctx.ctx, c->error);
 
-    JSValue test = JS_NewObject(ctx);
+        JSValue ret = JS_Call(vctx.ctx, success ? resolve : reject, JS_UNDEFINED, 1, &arg);
 
-    if(JS_IsException(test))
-        throw_exception(ctx, test);
+        JS_FreeValue(vctx.ctx, ret);
+        JS_FreeValue(vctx.ctx, arg);
+        JS_FreeValue(vctx.ctx, resolve);
+        JS_FreeValue(vctx.ctx, reject);
+    }
 
-    val = test;
-    has_value = true;
+    return done.size() > 0;
 }
 
-js_quickjs::value::value(js_quickjs::value_context& _vctx, const js_quickjs::undefined_t&)
+void js_quickjs::value_context::execute_jobs()
 {
-    vctx = &_vctx;
-    ctx = vctx->ctx;
-
-    val = JS_UNDEFINED;
-    has_value = false;
+    execute_jobs(SIZE_MAX, std::chrono::steady_clock::time_point::max());
 }
 
-js_quickjs::value::value(js_quickjs::value_context& vctx, const js_quickjs::value& other) : js_quickjs::value(other)
+bool js_quickjs::value_context::execute_jobs(size_t max_jobs, std::chrono::steady_clock::time_point deadline)
 {
+    heap_stash* stash = get_heap_stash(ctx);
 
-}
+    bool timed = deadline != std::chrono::steady_clock::time_point::max();
 
-js_quickjs::value::value(js_quickjs::value_context& _vctx, const js_quickjs::value& other, const std::string& key) : value(_vctx, other, key.c_str())
-{
+    ///drains without a deadline, including every unbounded execute_jobs(), never read the clock
+    std::chrono::steady_clock::time_point start;
 
-}
+    if(timed)
+        start = std::chrono::steady_clock::now();
+    size_t run = 0;
 
-js_quickjs::value::value(js_quickjs::value_context& _vctx, const js_quickjs::value& parent, const char* key)
-{
-    ctx = _vctx.ctx;
-    vctx = &_vctx;
+    auto in_budget = [&]()
+    {
+        return run < max_jobs && (!timed || std::chrono::steady_clock::now() < deadline);
+    };
 
-    if(!parent.has_value)
-        throw std::runtime_error("Parent is not a value");
+    JSContext* pending = nullptr;
 
-    has_parent = true;
-    parent_value = JS_DupValue(parent.ctx, parent.val);
-    indices = key;
+    while(in_budget())
+    {
+        while(in_budget() && JS_ExecutePendingJob(heap, &pending) > 0)
+        {
+            run++;
+        }
 
-    if(!parent.has(key))
-        return;
+        if(stash == nullptr || !in_budget())
+            break;
 
-    has_value = true;
-    val = JS_GetPropertyStr(ctx, parent_value, key);
-}
+        bool delivered = deliver_completions(*this, stash);
 
-js_quickjs::value::value(js_quickjs::value_context& _vctx, const js_quickjs::value& parent, int key)
-{
-    if(key < 0)
-        throw std::runtime_error("Key < 0");
+        if(!delivered && stash->ready_waiters.empty())
+            break;
 
-    ctx = _vctx.ctx;
-    vctx = &_vctx;
-    indices = key;
+        ///resuming runs arbitrary code which can queue more jobs or settle more waiters
+        std::vector<int64_t> ready;
+        ready.swap(stash->ready_waiters);
 
-    if(!parent.has_value)
-        throw std::runtime_error("Parent is not a value");
+        size_t next = 0;
 
-    has_parent = true;
-    parent_value = JS_DupValue(parent.ctx, parent.val);
+        ///out of budget or a resume threw, either way the rest go back in front of anything readied meanwhile
+        struct requeue_guard
+        {
+            heap_stash* stash;
+            std::vector<int64_t>& ready;
+            size_t& next;
 
-    if(!parent.has(key))
-        return;
+            ~requeue_guard()
+            {
+                stash->ready_waiters.insert(stash->ready_waiters.begin(), ready.begin() + next, ready.end());
+            }
+        } requeue{stash, ready, next};
 
-    JSValue test = JS_GetPropertyUint32(ctx, parent_value, key);
+        for(; next < ready.size() && in_budget(); next++)
+        {
+            auto it = stash->promise_waiters.find(ready[next]);
 
-    if(JS_IsException(test))
-        throw_exception(ctx, test);
+            if(it == stash->promise_waiters.end())
+                continue;
 
-    has_value = true;
-    val = test;
-}
+            void* address = it->second;
 
-js_quickjs::value::~value()
-{
-    if(!released && has_value)
-    {
-        JS_FreeValue(ctx, val);
+            stash->promise_waiters.erase(it);
+
+            run++;
+
+            #ifdef __cpp_impl_coroutine
+            std::coroutine_handle<>::from_address(address).resume();
+            #else
+            (void)address;
+            #endif
+        }
     }
 
-    if(has_parent)
+    bool remaining = JS_IsJobPending(heap) > 0;
+
+    if(stash)
     {
-        JS_FreeValue(ctx, parent_value);
+        remaining = remaining || stash->ready_waiters.size() > 0 || stash->completions->head.load() != nullptr;
+
+        job_stats& stats = stash->jobs;
+
+        stats.drains++;
+        stats.jobs += run;
+        stats.last_drain_jobs = run;
+
+        if(timed)
+        {
+            std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+
+            stats.timed_drains++;
+            stats.last_drain_time = elapsed;
+            stats.total_time += elapsed;
+            stats.max_drain_time = std::max(stats.max_drain_time, elapsed);
+        }
+
+        if(remaining)
+            stats.cut_short++;
     }
+
+    return remaining;
 }
 
-bool js_quickjs::value::has(const char* key) const
+js_quickjs::job_stats js_quickjs::value_context::get_job_stats()
 {
-    if(!has_value)
-        return false;
+    heap_stash* stash = get_heap_stash(ctx);
 
-    if(is_undefined())
-        return false;
+    if(stash == nullptr)
+        return job_stats();
 
-    JSAtom atom = JS_NewAtom(ctx, key);
+    return stash->jobs;
+}
 
-    if(atom == JS_ATOM_NULL)
-        throw std::runtime_error("Could not allocate atom");
+void js_quickjs::value_context::compact_heap_stash()
+{
+    heap_stash* stash = get_heap_stash(ctx);
 
-    bool has_prop = JS_HasProperty(ctx, val, atom);
+    stash->compact();
+}
 
-    JS_FreeAtom(ctx, atom);
+bool js_quickjs::value_context::compact_heap_stash(size_t budget)
+{
+    heap_stash* stash = get_heap_stash(ctx);
 
-    return has_prop;
+    ///an empty slice would never make progress while still reporting work left
+    return stash->compact_slice(std::max<size_t>(budget, 1));
 }
 
-bool js_quickjs::value::has_hidden(const std::string& key) const
+void js_quickjs::value_context::set_auto_compact(size_t budget)
 {
-    if(!has_value)
-        return false;
+    heap_stash* stash = get_heap_stash(ctx);
 
-    if(is_undefined())
-        return false;
+    stash->auto_compact_budget = budget;
+
+    if(budget > 0)
+        JS_SetInterruptHandler(heap, heap_interrupt, stash);
+    else if(stash->user_interrupt)
+        JS_SetInterruptHandler(heap, stash->user_interrupt, stash->sandbox);
+    else
+        JS_SetInterruptHandler(heap, nullptr, nullptr);
+}
 
+js_quickjs::heap_compact_stats js_quickjs::value_context::get_compact_stats()
+{
     heap_stash* stash = get_heap_stash(ctx);
 
-    return stash->has_hidden(*this, key);
+    return stash->compact_stats;
 }
 
-bool js_quickjs::value::has(const std::string& key) const
+///how much leftover work reset will run on the tenant's behalf before giving up on the context
+static constexpr size_t reset_job_limit = 1024;
+static constexpr std::chrono::milliseconds reset_job_time{50};
+
+void js_quickjs::value_context::reset()
 {
-    if(!has_value)
-        return false;
+    assert(runtime_owner && context_owner);
 
-    if(is_undefined())
-        return false;
+    heap_stash* hstash = get_heap_stash(ctx);
 
-    JSAtom atom = JS_NewAtomLen(ctx, key.c_str(), key.size());
+    ///let anything the tenant left queued finish in the tenant's environment
+    if(execute_jobs(reset_job_limit, std::chrono::steady_clock::now() + reset_job_time))
+        throw std::runtime_error("Tenant left jobs queued after reset drain");
 
-    if(atom == JS_ATOM_NULL)
-        throw std::runtime_error("Could not allocate atom");
+    if(hstash->pending_async.size() > 0 || hstash->promise_waiters.size() > 0)
+        throw std::runtime_error("Tenant left async work in flight");
 
-    bool has_prop = JS_HasProperty(ctx, val, atom);
+    this_stack.clear();
 
-    JS_FreeAtom(ctx, atom);
+    ///the loop outlives tenants, but their timers belong to the context being thrown away
+    if(hstash->loop)
+        hstash->loop->clear_timers();
 
-    return has_prop;
-}
+    ///deleting globals can't undo non configurable var/function bindings, let/const or patched builtins,
+    ///so the whole context is replaced
+    JSContext* next = JS_NewContext(heap);
 
-bool js_quickjs::value::has(int key) const
-{
-    if(key < 0)
-        throw std::runtime_error("value.has key < 0");
+    if(next == nullptr)
+        throw std::runtime_error("Could not create context in reset");
 
-    if(!has_value)
-        return false;
+    JSContext* old = ctx;
 
-    if(is_undefined())
-        return false;
+    delete (global_stash*)JS_GetContextOpaque(old);
+    JS_SetContextOpaque(old, nullptr);
 
-    JSAtom atom = JS_NewAtomUInt32(ctx, (uint32_t)key);
+    ctx = next;
 
-    if(atom == JS_ATOM_NULL)
-        throw std::runtime_error("Could not allocate atom");
+    try
+    {
+        hstash->rebind(next);
+    }
+    catch(...)
+    {
+        JS_FreeContext(old);
+        throw;
+    }
 
-    bool has_prop = JS_HasProperty(ctx, val, atom);
+    JS_FreeContext(old);
 
-    JS_FreeAtom(ctx, atom);
+    init_context(ctx);
 
-    return has_prop;
-}
+    if(hstash->loop)
+        hstash->loop->install_timers();
 
-js_quickjs::value js_quickjs::value::get(const std::string& key)
-{
-    return js_quickjs::value(*vctx, *this, key);
+    JS_SetMemoryLimit(heap, memory_limit);
+    JS_RunGC(heap);
 }
 
-js_quickjs::value js_quickjs::value::get(int key)
+bool js_quickjs::value_context::has_promise_waiters()
 {
-    return js_quickjs::value(*vctx, *this, key);
-}
+    heap_stash* hstash = get_heap_stash(ctx);
 
-js_quickjs::value js_quickjs::value::get(const char* key)
-{
-    return js_quickjs::value(*vctx, *this, key);
+    return hstash && hstash->promise_waiters.size() > 0;
 }
 
-js_quickjs::value js_quickjs::value::get_hidden(const std::string& key)
+js_quickjs::value_context_pool::lease::lease(value_context_pool* _pool, std::unique_ptr<value_context> _vctx) : pool(_pool), vctx(std::move(_vctx))
 {
-    if(!has_hidden(key))
-    {
-        js_quickjs::value val(*vctx);
-        val = js_quickjs::undefined;
-        return val;
-    }
-
-    heap_stash* heap = get_heap_stash(ctx);
 
-    return heap->get_hidden(*this, key);
 }
 
-bool js_quickjs::value::del(const std::string& key)
+js_quickjs::value_context_pool::lease::lease(lease&& other) : pool(other.pool), vctx(std::move(other.vctx))
 {
-    if(!has(key))
-        return false;
+    other.pool = nullptr;
+}
 
-    JSAtom atom = JS_NewAtomLen(ctx, key.c_str(), key.size());
+js_quickjs::value_context_pool::lease& js_quickjs::value_context_pool::lease::operator=(lease&& other)
+{
+    if(this == &other)
+        return *this;
 
-    if(atom == JS_ATOM_NULL)
-        throw std::runtime_error("Could not allocate atom");
+    if(pool && vctx)
+        pool->release(std::move(vctx));
 
-    JS_DeleteProperty(ctx, val, atom, 0);
+    pool = other.pool;
+    vctx = std::move(other.vctx);
 
-    JS_FreeAtom(ctx, atom);
+    other.pool = nullptr;
 
-    return true;
+    return *this;
 }
 
-void js_quickjs::value::add_hidden_value(const std::string& key, const value& val)
+js_quickjs::value_context_pool::lease::~lease()
 {
-    heap_stash* heap = get_heap_stash(ctx);
-
-    heap->add_hidden(*this, key, val);
+    if(pool && vctx)
+        pool->release(std::move(vctx));
 }
 
-bool js_quickjs::value::is_string()
+js_quickjs::value_context_pool::value_context_pool(int size, JSInterruptHandler _handler, void* _sandbox)
 {
-    if(!has_value)
-        return false;
+    max_size = size;
+    handler = _handler;
+    sandbox = _sandbox;
 
-    return JS_IsString(val);
+    for(int i=0; i < size; i++)
+    {
+        free_list.push_back(make_context());
+    }
 }
 
-bool js_quickjs::value::is_number()
+js_quickjs::value_context_pool::~value_context_pool()
 {
-    if(!has_value)
-        return false;
-
-    return JS_IsNumber(val);
+    ///a parked context whose coroutines were never resumed or destroyed is leaked, since freeing it would leave
+    ///their watchers pointing into a dead runtime
+    for(std::unique_ptr<value_context>& vctx : parked)
+    {
+        if(vctx->has_promise_waiters())
+            (void)vctx.release();
+    }
 }
 
-bool js_quickjs::value::is_array()
+std::unique_ptr<js_quickjs::value_context> js_quickjs::value_context_pool::make_context()
 {
-    if(!has_value)
-        return false;
-
-    return JS_IsArray(ctx, val);
+    return std::make_unique<value_context>(handler, sandbox);
 }
 
-bool js_quickjs::value::is_map()
+js_quickjs::value_context_pool::lease js_quickjs::value_context_pool::acquire()
 {
-    if(!has_value)
-        return false;
+    std::unique_ptr<value_context> next;
 
-    return JS_IsObject(val);
-}
+    {
+        std::lock_guard guard(mut);
 
-bool js_quickjs::value::is_empty()
-{
-    return !has_value;
-}
+        if(free_list.size() > 0)
+        {
+            next = std::move(free_list.back());
+            free_list.pop_back();
 
-bool js_quickjs::value::is_function() const
-{
-    if(!has_value)
-        return false;
+            pool_stats.hits++;
+        }
+        else
+        {
+            pool_stats.misses++;
+        }
+    }
 
-    return JS_IsFunction(ctx, val);
+    if(!next)
+        next = make_context();
+
+    return lease(this, std::move(next));
 }
 
-bool js_quickjs::value::is_boolean()
+///a context that fails to reset is dropped rather than handed to the next tenant, or parked if a coroutine is
+///still suspended on it
+void js_quickjs::value_context_pool::release(std::unique_ptr<value_context> vctx)
 {
-    if(!has_value)
-        return false;
+    auto start = std::chrono::steady_clock::now();
 
-    return JS_IsBool(val);
-}
+    bool success = true;
 
-bool js_quickjs::value::is_undefined() const
-{
-    if(!has_value)
-        return false;
+    try
+    {
+        vctx->reset();
+    }
+    catch(...)
+    {
+        success = false;
+    }
 
-    return JS_IsUndefined(val);
-}
+    std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
 
-bool js_quickjs::value::is_truthy()
-{
-    if(!has_value)
-        return false;
+    std::lock_guard guard(mut);
 
-    return JS_ToBool(ctx, val) > 0;
-}
+    if(!success)
+    {
+        pool_stats.reset_failures++;
 
-bool js_quickjs::value::is_object_coercible()
-{
-    if(!has_value)
-        return false;
+        if(vctx->has_promise_waiters())
+        {
+            pool_stats.parked++;
+            parked.push_back(std::move(vctx));
+        }
 
-    /*DUK_TYPE_MASK_BOOLEAN | \
-      DUK_TYPE_MASK_NUMBER | \
-      DUK_TYPE_MASK_STRING | \
-      DUK_TYPE_MASK_OBJECT | \
-      DUK_TYPE_MASK_BUFFER | \
-      DUK_TYPE_MASK_POINTER | \
-      DUK_TYPE_MASK_LIGHTFUNC + SYMBOL*/
+        return;
+    }
 
-    bool is_sym = JS_IsSymbol(val);
+    pool_stats.resets++;
+    pool_stats.total_reset_time += elapsed;
+    pool_stats.max_reset_time = std::max(pool_stats.max_reset_time, elapsed);
 
-    return is_object() || is_boolean() || is_number() || is_function() || is_sym || is_string();
+    if((int)free_list.size() < max_size)
+        free_list.push_back(std::move(vctx));
 }
 
-bool js_quickjs::value::is_object() const
+js_quickjs::value_context_pool::stats js_quickjs::value_context_pool::get_stats()
 {
-    if(!has_value)
-        return false;
+    std::lock_guard guard(mut);
 
-    return JS_IsObject(val);
+    return pool_stats;
 }
 
-bool js_quickjs::value::is_error() const
+void js_quickjs::value_context::execute_timeout_check()
 {
-    if(!has_value)
-        return false;
+    JSInterruptHandler* handler = JS_GetInterruptHandler(heap);
 
-    return JS_IsError(ctx, val);
+    if(handler != nullptr)
+    {
+        ///todo: handle return values
+        int ret = handler(heap, JS_GetInterruptHandlerOpaque(heap));
+
+        (void)ret;
+    }
 }
 
-bool js_quickjs::value::is_exception() const
+///duplicating an atom needs a context, and reset may have freed the one the key was made in. The heap stash
+///always tracks the runtime's live context
+static JSAtom dup_key_atom(const js_quickjs::key& k)
 {
-    if(!has_value)
-        return false;
+    heap_stash* stash = (heap_stash*)JS_GetRuntimeOpaque(k.heap);
 
-    return JS_IsException(val);
+    return JS_DupAtom(stash ? stash->ctx : k.ctx, k.atom);
 }
 
-void js_quickjs::value::release()
+js_quickjs::key::key(js_quickjs::value_context& vctx, std::string_view name)
 {
-    released = true;
-}
+    ctx = vctx.ctx;
+    heap = JS_GetRuntime(ctx);
 
-/*
-stack_manage::stack_manage(js::value& in) : sh(in)
-{
-    if(sh.indices.index() == 0)
+    heap_stash* stash = get_heap_stash(ctx);
+
+    if(stash)
     {
-        ///nothing
+        atom = JS_DupAtom(ctx, stash->intern(name));
     }
     else
     {
-        if(sh.indices.index() == 1)
-            duk_push_int(sh.ctx, std::get<1>(sh.indices));
-        else
-            duk_push_string(sh.ctx, std::get<2>(sh.indices).c_str());
+        atom = JS_NewAtomLen(ctx, name.data(), name.size());
+
+        if(atom == JS_ATOM_NULL)
+            throw std::runtime_error("Could not allocate atom");
+    }
+}
+
+js_quickjs::key::key(const js_quickjs::key& other)
+{
+    heap = other.heap;
+    ctx = other.ctx;
+    atom = dup_key_atom(other);
+}
+
+js_quickjs::key::key(js_quickjs::key&& other) noexcept
+{
+    heap = other.heap;
+    ctx = other.ctx;
+    atom = other.atom;
+
+    other.atom = JS_ATOM_NULL;
+}
+
+js_quickjs::key::~key()
+{
+    if(atom != JS_ATOM_NULL)
+        JS_FreeAtomRT(heap, atom);
+}
+
+js_quickjs::key& js_quickjs::key::operator=(const js_quickjs::key& other)
+{
+    if(this == &other)
+        return *this;
+
+    if(atom != JS_ATOM_NULL)
+        JS_FreeAtomRT(heap, atom);
+
+    heap = other.heap;
+    ctx = other.ctx;
+    atom = dup_key_atom(other);
+
+    return *this;
+}
+
+js_quickjs::key& js_quickjs::key::operator=(js_quickjs::key&& other) noexcept
+{
+    if(this == &other)
+        return *this;
+
+    if(atom != JS_ATOM_NULL)
+        JS_FreeAtomRT(heap, atom);
+
+    heap = other.heap;
+    ctx = other.ctx;
+    atom = other.atom;
+
+    other.atom = JS_ATOM_NULL;
+
+    return *this;
+}
+
+js_quickjs::value::value(const js_quickjs::value& other)
+{
+    vctx = other.vctx;
+    ctx = other.ctx;
+
+    val = JS_DupValue(other.ctx, other.val);
+    has_value = true;
+
+    if(other.has_parent)
+    {
+        has_parent = true;
+        parent_value = JS_DupValue(other.ctx, other.parent_value);
+        indices = other.indices;
+    }
+}
+
+js_quickjs::value::value(js_quickjs::value&& other) noexcept
+{
+    vctx = other.vctx;
+    ctx = other.ctx;
+
+    val = other.val;
+    has_value = other.has_value;
+    released = other.released;
+
+    has_parent = other.has_parent;
+    parent_value = other.parent_value;
+    indices = std::move(other.indices);
+
+    other.val = JS_UNDEFINED;
+    other.parent_value = JS_UNDEFINED;
+    other.has_value = false;
+    other.has_parent = false;
+    other.released = false;
+}
+
+js_quickjs::value::value(js_quickjs::value_context& _vctx)
+{
+    vctx = &_vctx;
+    ctx = vctx->ctx;
+
+    JSValue test = JS_NewObject(ctx);
+
+    if(JS_IsException(test))
+        throw_exception(ctx, test);
+
+    val = test;
+    has_value = true;
+}
+
+js_quickjs::value::value(js_quickjs::value_context& _vctx, const js_quickjs::undefined_t&)
+{
+    vctx = &_vctx;
+    ctx = vctx->ctx;
+
+    val = JS_UNDEFINED;
+    has_value = false;
+}
+
+js_quickjs::value::value(js_quickjs::value_context& vctx, const js_quickjs::value& other) : js_quickjs::value(other)
+{
+
+}
+
+js_quickjs::value::value(js_quickjs::value_context& _vctx, const js_quickjs::value& other, const std::string& key) : value(_vctx, other, key.c_str())
+{
+
+}
+
+///resolves presence and value with one lookup. Only a property that reads back as undefined
+///needs a second probe, to tell an absent property from one holding undefined
+///primitives always report a value, as has() used to treat them as having every key. This keeps
+///str["length"] working through the primitive's prototype
+static bool get_existing_property(JSContext* ctx, JSValueConst parent, JSAtom atom, JSValue& out)
+{
+    JSValue found = JS_GetProperty(ctx, parent, atom);
+
+    if(JS_IsException(found))
+        js_quickjs::throw_exception(ctx, found);
+
+    if(!JS_IsUndefined(found) || !JS_IsObject(parent))
+    {
+        out = found;
+        return true;
+    }
+
+    int present = JS_HasProperty(ctx, parent, atom);
+
+    if(present < 0)
+        js_quickjs::throw_exception(ctx, JS_UNDEFINED);
+
+    out = JS_UNDEFINED;
+    return present > 0;
+}
+
+js_quickjs::value::value(js_quickjs::value_context& _vctx, const js_quickjs::value& parent, const char* key)
+{
+    ctx = _vctx.ctx;
+    vctx = &_vctx;
+
+    if(!parent.has_value)
+        throw std::runtime_error("Parent is not a value");
+
+    has_parent = true;
+    parent_value = JS_DupValue(parent.ctx, parent.val);
+    indices = key;
+
+    JSAtom atom = JS_NewAtom(ctx, key);
+
+    if(atom == JS_ATOM_NULL)
+        throw std::runtime_error("Could not allocate atom");
+
+    try
+    {
+        has_value = get_existing_property(ctx, parent_value, atom, val);
+    }
+    catch(...)
+    {
+        JS_FreeAtom(ctx, atom);
+        throw;
+    }
+
+    JS_FreeAtom(ctx, atom);
+}
+
+js_quickjs::value::value(js_quickjs::value_context& _vctx, const js_quickjs::value& parent, int key)
+{
+    if(key < 0)
+        throw std::runtime_error("Key < 0");
+
+    ctx = _vctx.ctx;
+    vctx = &_vctx;
+    indices = key;
+
+    if(!parent.has_value)
+        throw std::runtime_error("Parent is not a value");
+
+    has_parent = true;
+    parent_value = JS_DupValue(parent.ctx, parent.val);
+
+    ///integer lookups don't need an atom unless we have to fall back to a presence check
+    JSValue test = JS_GetPropertyUint32(ctx, parent_value, key);
+
+    if(JS_IsException(test))
+        throw_exception(ctx, test);
+
+    ///primitives are treated as having every index, see get_existing_property
+    if(!JS_IsUndefined(test) || !JS_IsObject(parent_value))
+    {
+        has_value = true;
+        val = test;
+        return;
+    }
+
+    if(!parent.has(key))
+        return;
+
+    has_value = true;
+    val = test;
+}
+
+js_quickjs::value::value(js_quickjs::value_context& _vctx, const js_quickjs::value& parent, const js_quickjs::key& key)
+{
+    ctx = _vctx.ctx;
+    vctx = &_vctx;
+
+    if(!parent.has_value)
+        throw std::runtime_error("Parent is not a value");
+
+    has_parent = true;
+    parent_value = JS_DupValue(parent.ctx, parent.val);
+    indices = key;
+
+    has_value = get_existing_property(ctx, parent_value, key.atom, val);
+}
+
+js_quickjs::value::~value()
+{
+    if(!released && has_value)
+    {
+        JS_FreeValue(ctx, val);
+    }
+
+    if(has_parent)
+    {
+        JS_FreeValue(ctx, parent_value);
+    }
+}
+
+bool js_quickjs::value::has(const char* key) const
+{
+    if(!has_value)
+        return false;
+
+    if(is_undefined())
+        return false;
+
+    JSAtom atom = JS_NewAtom(ctx, key);
+
+    if(atom == JS_ATOM_NULL)
+        throw std::runtime_error("Could not allocate atom");
+
+    bool has_prop = JS_HasProperty(ctx, val, atom);
+
+    JS_FreeAtom(ctx, atom);
+
+    return has_prop;
+}
+
+bool js_quickjs::value::has_hidden(const std::string& key) const
+{
+    if(!has_value)
+        return false;
+
+    if(is_undefined())
+        return false;
+
+    heap_stash* stash = get_heap_stash(ctx);
+
+    return stash->has_hidden(*this, key);
+}
+
+bool js_quickjs::value::has(const std::string& key) const
+{
+    if(!has_value)
+        return false;
+
+    if(is_undefined())
+        return false;
+
+    JSAtom atom = JS_NewAtomLen(ctx, key.c_str(), key.size());
+
+    if(atom == JS_ATOM_NULL)
+        throw std::runtime_error("Could not allocate atom");
+
+    bool has_prop = JS_HasProperty(ctx, val, atom);
+
+    JS_FreeAtom(ctx, atom);
+
+    return has_prop;
+}
+
+bool js_quickjs::value::has(int key) const
+{
+    if(key < 0)
+        throw std::runtime_error("value.has key < 0");
+
+    if(!has_value)
+        return false;
+
+    if(is_undefined())
+        return false;
+
+    JSAtom atom = JS_NewAtomUInt32(ctx, (uint32_t)key);
+
+    if(atom == JS_ATOM_NULL)
+        throw std::runtime_error("Could not allocate atom");
+
+    bool has_prop = JS_HasProperty(ctx, val, atom);
+
+    JS_FreeAtom(ctx, atom);
+
+    return has_prop;
+}
+
+bool js_quickjs::value::has(const js_quickjs::key& key) const
+{
+    if(!has_value)
+        return false;
+
+    if(is_undefined())
+        return false;
+
+    return JS_HasProperty(ctx, val, key.atom);
+}
+
+js_quickjs::value js_quickjs::value::get(const std::string& key)
+{
+    return js_quickjs::value(*vctx, *this, key);
+}
+
+js_quickjs::value js_quickjs::value::get(int key)
+{
+    return js_quickjs::value(*vctx, *this, key);
+}
+
+js_quickjs::value js_quickjs::value::get(const char* key)
+{
+    return js_quickjs::value(*vctx, *this, key);
+}
+
+js_quickjs::value js_quickjs::value::get(const js_quickjs::key& key)
+{
+    return js_quickjs::value(*vctx, *this, key);
+}
+
+js_quickjs::value js_quickjs::value::get_hidden(const std::string& key)
+{
+    if(!has_hidden(key))
+    {
+        js_quickjs::value val(*vctx);
+        val = js_quickjs::undefined;
+        return val;
+    }
+
+    heap_stash* heap = get_heap_stash(ctx);
+
+    return heap->get_hidden(*this, key);
+}
+
+bool js_quickjs::value::del(const std::string& key)
+{
+    if(!has(key))
+        return false;
+
+    JSAtom atom = JS_NewAtomLen(ctx, key.c_str(), key.size());
+
+    if(atom == JS_ATOM_NULL)
+        throw std::runtime_error("Could not allocate atom");
+
+    JS_DeleteProperty(ctx, val, atom, 0);
+
+    JS_FreeAtom(ctx, atom);
+
+    return true;
+}
+
+bool js_quickjs::value::del(const js_quickjs::key& key)
+{
+    if(!has(key))
+        return false;
+
+    JS_DeleteProperty(ctx, val, key.atom, 0);
+
+    return true;
+}
+
+void js_quickjs::value::add_hidden_value(const std::string& key, const value& val)
+{
+    heap_stash* heap = get_heap_stash(ctx);
+
+    heap->add_hidden(*this, key, val);
+}
+
+bool js_quickjs::value::is_string()
+{
+    if(!has_value)
+        return false;
+
+    return JS_IsString(val);
+}
+
+bool js_quickjs::value::is_number()
+{
+    if(!has_value)
+        return false;
+
+    return JS_IsNumber(val);
+}
+
+bool js_quickjs::value::is_array()
+{
+    if(!has_value)
+        return false;
+
+    return JS_IsArray(ctx, val);
+}
+
+bool js_quickjs::value::is_map()
+{
+    if(!has_value)
+        return false;
+
+    return JS_IsObject(val);
+}
+
+bool js_quickjs::value::is_empty()
+{
+    return !has_value;
+}
+
+bool js_quickjs::value::is_function() const
+{
+    if(!has_value)
+        return false;
+
+    return JS_IsFunction(ctx, val);
+}
+
+bool js_quickjs::value::is_boolean()
+{
+    if(!has_value)
+        return false;
+
+    return JS_IsBool(val);
+}
+
+bool js_quickjs::value::is_undefined() const
+{
+    if(!has_value)
+        return false;
+
+    return JS_IsUndefined(val);
+}
+
+bool js_quickjs::value::is_truthy()
+{
+    if(!has_value)
+        return false;
+
+    return JS_ToBool(ctx, val) > 0;
+}
+
+bool js_quickjs::value::is_object_coercible()
+{
+    if(!has_value)
+        return false;
+
+    /*DUK_TYPE_MASK_BOOLEAN | \
+      DUK_TYPE_MASK_NUMBER | \
+      DUK_TYPE_MASK_STRING | \
+      DUK_TYPE_MASK_OBJECT | \
+      DUK_TYPE_MASK_BUFFER | \
+      DUK_TYPE_MASK_POINTER | \
+      DUK_TYPE_MASK_LIGHTFUNC + SYMBOL*/
+
+    bool is_sym = JS_IsSymbol(val);
+
+    return is_object() || is_boolean() || is_number() || is_function() || is_sym || is_string();
+}
+
+bool js_quickjs::value::is_object() const
+{
+    if(!has_value)
+        return false;
+
+    return JS_IsObject(val);
+}
+
+bool js_quickjs::value::is_error() const
+{
+    if(!has_value)
+        return false;
+
+    return JS_IsError(ctx, val);
+}
+
+bool js_quickjs::value::is_exception() const
+{
+    if(!has_value)
+        return false;
+
+    return JS_IsException(val);
+}
+
+void js_quickjs::value::release()
+{
+    released = true;
+}
+
+/*
+stack_manage::stack_manage(js::value& in) : sh(in)
+{
+    if(sh.indices.index() == 0)
+    {
+        ///nothing
+    }
+    else
+    {
+        if(sh.indices.index() == 1)
+            duk_push_int(sh.ctx, std::get<1>(sh.indices));
+        else
+            duk_push_string(sh.ctx, std::get<2>(sh.indices).c_str());
+    }
+}
+
+stack_manage::~stack_manage()
+{
+    if(sh.indices.index() == 0)
+    {
+        if(sh.idx != -1)
+            duk_replace(sh.ctx, sh.idx);
+        else
+            sh.idx = duk_get_top_index(sh.ctx);
+    }
+    else
+    {
+        ///replace property on parent
+        duk_put_prop(sh.ctx, sh.parent_idx);
+
+        ///update stack object as well
+        if(sh.indices.index() == 1)
+            duk_push_int(sh.ctx, std::get<1>(sh.indices));
+        else
+            duk_push_string(sh.ctx, std::get<2>(sh.indices).c_str());
+
+        duk_get_prop(sh.ctx, sh.parent_idx);
+
+        if(sh.idx != -1)
+            duk_replace(sh.ctx, sh.idx);
+        else
+            sh.idx = duk_get_top_index(sh.ctx);
+    }
+}*/
+
+js_quickjs::qstack_manager::qstack_manager(js_quickjs::value& _val) : val(_val)
+{
+    if(val.has_value)
+    {
+        JS_FreeValue(val.ctx, val.val);
+    }
+}
+
+///not exactly the same behaviour of duktape
+///if i replace a parent object in duktape, children will relocate to that parent index
+///here its actually object-y, so they'll refer to the old object
+js_quickjs::qstack_manager::~qstack_manager()
+{
+    val.has_value = true;
+
+    if(val.has_parent)
+    {
+        if(val.indices.index() == 0)
+            assert(false);
+
+        if(val.indices.index() == 1)
+        {
+            int idx = std::get<1>(val.indices);
+
+            assert(idx >= 0);
+
+            JSValue dp = JS_DupValue(val.ctx, val.val);
+
+            JS_SetPropertyUint32(val.ctx, val.parent_value, idx, dp);
+        }
+        else if(val.indices.index() == 2)
+        {
+            const std::string& idx = std::get<2>(val.indices);
+
+            JSValue dp = JS_DupValue(val.ctx, val.val);
+
+            JS_SetPropertyStr(val.ctx, val.parent_value, idx.c_str(), dp);
+        }
+        else
+        {
+            const js_quickjs::key& idx = std::get<3>(val.indices);
+
+            JSValue dp = JS_DupValue(val.ctx, val.val);
+
+            JS_SetProperty(val.ctx, val.parent_value, idx.atom, dp);
+        }
+    }
+}
+
+///builds the JS tree directly from the json tree, equivalent to JS_ParseJSON(in.dump())
+static JSValue json_to_js(JSContext* ctx, const nlohmann::json& in, int depth_left)
+{
+    if(depth_left < 0)
+        throw std::runtime_error("Exceeded max depth in json conversion");
+
+    switch(in.type())
+    {
+        case nlohmann::json::value_t::null:
+            return JS_NULL;
+
+        case nlohmann::json::value_t::discarded:
+            return JS_UNDEFINED;
+
+        case nlohmann::json::value_t::boolean:
+            return JS_NewBool(ctx, in.get<bool>());
+
+        case nlohmann::json::value_t::number_integer:
+            return JS_NewInt64(ctx, in.get<int64_t>());
+
+        case nlohmann::json::value_t::number_unsigned:
+        {
+            uint64_t v = in.get<uint64_t>();
+
+            if(v <= (uint64_t)INT64_MAX)
+                return JS_NewInt64(ctx, (int64_t)v);
+
+            return JS_NewFloat64(ctx, (double)v);
+        }
+
+        case nlohmann::json::value_t::number_float:
+        {
+            double v = in.get<double>();
+
+            ///nlohmann serialises non finite numbers as null
+            if(!std::isfinite(v))
+                return JS_NULL;
+
+            return JS_NewFloat64(ctx, v);
+        }
+
+        case nlohmann::json::value_t::string:
+        {
+            const std::string& str = in.get_ref<const std::string&>();
+
+            return JS_NewStringLen(ctx, str.c_str(), str.size());
+        }
+
+        case nlohmann::json::value_t::array:
+        {
+            JSValue arr = JS_NewArray(ctx);
+
+            if(JS_IsException(arr))
+                js_quickjs::throw_exception(ctx, arr);
+
+            try
+            {
+                uint32_t idx = 0;
+
+                for(const nlohmann::json& i : in)
+                {
+                    JS_DefinePropertyValueUint32(ctx, arr, idx, json_to_js(ctx, i, depth_left - 1), JS_PROP_C_W_E);
+                    idx++;
+                }
+            }
+            catch(...)
+            {
+                JS_FreeValue(ctx, arr);
+                throw;
+            }
+
+            return arr;
+        }
+
+        case nlohmann::json::value_t::object:
+        {
+            JSValue obj = JS_NewObject(ctx);
+
+            if(JS_IsException(obj))
+                js_quickjs::throw_exception(ctx, obj);
+
+            try
+            {
+                for(auto& [key, val] : in.items())
+                {
+                    JSAtom atom = JS_NewAtomLen(ctx, key.c_str(), key.size());
+
+                    if(atom == JS_ATOM_NULL)
+                        throw std::runtime_error("Could not allocate atom");
+
+                    JSValue next = JS_UNDEFINED;
+
+                    try
+                    {
+                        next = json_to_js(ctx, val, depth_left - 1);
+                    }
+                    catch(...)
+                    {
+                        JS_FreeAtom(ctx, atom);
+                        throw;
+                    }
+
+                    JS_DefinePropertyValue(ctx, obj, atom, next, JS_PROP_C_W_E);
+                    JS_FreeAtom(ctx, atom);
+                }
+            }
+            catch(...)
+            {
+                JS_FreeValue(ctx, obj);
+                throw;
+            }
+
+            return obj;
+        }
+
+        ///matches the layout dump() produces for binary values
+        case nlohmann::json::value_t::binary:
+        {
+            nlohmann::json as_object;
+            as_object["bytes"] = std::vector<uint8_t>(in.get_binary().begin(), in.get_binary().end());
+
+            if(in.get_binary().has_subtype())
+                as_object["subtype"] = in.get_binary().subtype();
+            else
+                as_object["subtype"] = nullptr;
+
+            return json_to_js(ctx, as_object, depth_left);
+        }
+    }
+
+    return JS_UNDEFINED;
+}
+
+///values JSON.stringify omits from objects and turns into null inside arrays
+static bool is_json_skipped(JSContext* ctx, JSValueConst val)
+{
+    return JS_IsUndefined(val) || JS_IsSymbol(val) || JS_IsFunction(ctx, val);
+}
+
+///JSON.stringify serialises new Number(1) and friends as the primitive they wrap. Returns false for
+///anything else, including objects that only inherit from a wrapper's prototype
+static bool unwrap_boxed_primitive(JSContext* ctx, JSValueConst val, JSValue& out)
+{
+    global_stash* stash = (global_stash*)JS_GetContextOpaque(ctx);
+
+    if(stash == nullptr)
+        return false;
+
+    for(auto& [ctor, value_of] : stash->boxed_primitives)
+    {
+        int is_instance = JS_IsInstanceOf(ctx, val, ctor);
+
+        if(is_instance < 0)
+            js_quickjs::throw_exception(ctx, JS_UNDEFINED);
+
+        if(is_instance == 0)
+            continue;
+
+        ///the intrinsic valueOf throws unless val really wraps a primitive of its type
+        JSValue prim = JS_Call(ctx, value_of, val, 0, nullptr);
+
+        if(JS_IsException(prim))
+        {
+            JS_FreeValue(ctx, JS_GetException(ctx));
+            continue;
+        }
+
+        out = prim;
+        return true;
+    }
+
+    return false;
+}
+
+///JSON.stringify's toJSON step, called with the member's key or index. Consumes val and returns what should be
+///serialised in its place. make_key is only called when there's a toJSON to pass it to
+template<typename F>
+static JSValue apply_to_json(JSContext* ctx, JSValue val, F&& make_key)
+{
+    js_quickjs::jsvalue_guard held(ctx, val);
+
+    if(!JS_IsObject(val))
+        return held.release();
+
+    JSValue to_json = JS_GetPropertyStr(ctx, val, "toJSON");
+
+    if(JS_IsException(to_json))
+        js_quickjs::throw_exception(ctx, to_json);
+
+    if(!JS_IsFunction(ctx, to_json))
+    {
+        JS_FreeValue(ctx, to_json);
+        return held.release();
+    }
+
+    JSValue key = make_key();
+
+    if(JS_IsException(key))
+    {
+        JS_FreeValue(ctx, to_json);
+        js_quickjs::throw_exception(ctx, key);
+    }
+
+    JSValue replaced = JS_Call(ctx, to_json, val, 1, &key);
+
+    JS_FreeValue(ctx, key);
+    JS_FreeValue(ctx, to_json);
+
+    if(JS_IsException(replaced))
+        js_quickjs::throw_exception(ctx, replaced);
+
+    return replaced;
+}
+
+///walks the JS tree directly, equivalent to nlohmann::json::parse(JSON.stringify(val))
+///val has already been through apply_to_json, as has each member before it's converted
+static nlohmann::json js_to_json(JSContext* ctx, JSValueConst val, int depth_left)
+{
+    if(depth_left < 0)
+        throw std::runtime_error("Exceeded max depth in json conversion");
+
+    int tag = JS_VALUE_GET_TAG(val);
+
+    if(tag == JS_TAG_INT)
+        return (int64_t)JS_VALUE_GET_INT(val);
+
+    if(JS_TAG_IS_FLOAT64(tag))
+    {
+        double d = JS_VALUE_GET_FLOAT64(val);
+
+        if(!std::isfinite(d))
+            return nullptr;
+
+        ///JSON.stringify writes integral doubles without a fraction, which parse back as integers
+        if(d == std::trunc(d) && std::fabs(d) < 9007199254740992.)
+            return (int64_t)d;
+
+        return d;
+    }
+
+    if(tag == JS_TAG_BOOL)
+        return (bool)JS_VALUE_GET_BOOL(val);
+
+    if(tag == JS_TAG_STRING)
+    {
+        size_t len = 0;
+        const char* str = JS_ToCStringLen(ctx, &len, val);
+
+        if(str == nullptr)
+            js_quickjs::throw_exception(ctx, JS_UNDEFINED);
+
+        std::string ret(str, str + len);
+
+        JS_FreeCString(ctx, str);
+
+        return ret;
+    }
+
+    if(tag == JS_TAG_BIG_INT)
+        throw std::runtime_error("BigInt value can't be converted to json");
+
+    if(!JS_IsObject(val) || JS_IsFunction(ctx, val))
+        return nullptr;
+
+    if(JSValue prim = JS_UNDEFINED; unwrap_boxed_primitive(ctx, val, prim))
+    {
+        nlohmann::json ret;
+
+        try
+        {
+            ret = js_to_json(ctx, prim, depth_left);
+        }
+        catch(...)
+        {
+            JS_FreeValue(ctx, prim);
+            throw;
+        }
+
+        JS_FreeValue(ctx, prim);
+
+        return ret;
+    }
+
+    if(JS_IsArray(ctx, val) > 0)
+    {
+        uint32_t len = js_quickjs::get_element_count(ctx, val);
+
+        nlohmann::json ret = nlohmann::json::array();
+
+        for(uint32_t i=0; i < len; i++)
+        {
+            JSValue element = JS_GetPropertyUint32(ctx, val, i);
+
+            if(JS_IsException(element))
+                js_quickjs::throw_exception(ctx, element);
+
+            js_quickjs::jsvalue_guard found(ctx, apply_to_json(ctx, element, [&](){return JS_NewString(ctx, std::to_string(i).c_str());}));
+
+            if(is_json_skipped(ctx, found.val))
+                ret.push_back(nullptr);
+            else
+                ret.push_back(js_to_json(ctx, found.val, depth_left - 1));
+        }
+
+        return ret;
+    }
+
+    JSPropertyEnum* names = nullptr;
+    uint32_t len = 0;
+
+    if(JS_GetOwnPropertyNames(ctx, &names, &len, val, JS_GPN_STRING_MASK|JS_GPN_ENUM_ONLY) < 0)
+        js_quickjs::throw_exception(ctx, JS_UNDEFINED);
+
+    nlohmann::json ret = nlohmann::json::object();
+
+    uint32_t i = 0;
+
+    try
+    {
+        for(; i < len; i++)
+        {
+            JSAtom atom = names[i].atom;
+
+            JSValue member = JS_GetProperty(ctx, val, atom);
+
+            if(JS_IsException(member))
+                js_quickjs::throw_exception(ctx, member);
+
+            js_quickjs::jsvalue_guard found(ctx, apply_to_json(ctx, member, [&](){return JS_AtomToString(ctx, atom);}));
+
+            ///a member whose toJSON returns undefined is left out, as with JSON.stringify
+            if(!is_json_skipped(ctx, found.val))
+            {
+                const char* key = JS_AtomToCString(ctx, atom);
+
+                try
+                {
+                    if(key == nullptr)
+                        throw std::runtime_error("Could not convert atom to string");
+
+                    ret[key] = js_to_json(ctx, found.val, depth_left - 1);
+                }
+                catch(...)
+                {
+                    if(key)
+                        JS_FreeCString(ctx, key);
+
+                    throw;
+                }
+
+                JS_FreeCString(ctx, key);
+            }
+
+            JS_FreeAtom(ctx, atom);
+        }
+    }
+    catch(...)
+    {
+        for(; i < len; i++)
+        {
+            JS_FreeAtom(ctx, names[i].atom);
+        }
+
+        js_free(ctx, names);
+        throw;
+    }
+
+    js_free(ctx, names);
+
+    return ret;
+}
+
+static JSValue get_typed_array_ctor(JSContext* ctx, std::string_view name)
+{
+    global_stash* stash = (global_stash*)JS_GetContextOpaque(ctx);
+
+    if(stash)
+        return stash->get_typed_array_ctor(name);
+
+    JSValue glob = JS_GetGlobalObject(ctx);
+    JSValue ctor = JS_GetPropertyStr(ctx, glob, std::string(name).c_str());
+
+    JS_FreeValue(ctx, glob);
+
+    return ctor;
+}
+
+JSValue js_quickjs::new_typed_array(JSContext* ctx, const char* ctor_name, JSValue buffer, size_t count)
+{
+    JSValue ctor = get_typed_array_ctor(ctx, ctor_name);
+
+    if(JS_IsException(ctor))
+    {
+        JS_FreeValue(ctx, buffer);
+        return ctor;
+    }
+
+    JSValue args[3] = {buffer, JS_NewInt32(ctx, 0), JS_NewInt64(ctx, count)};
+
+    JSValue ret = JS_CallConstructor(ctx, ctor, 3, args);
+
+    JS_FreeValue(ctx, ctor);
+    JS_FreeValue(ctx, buffer);
+
+    return ret;
+}
+
+JSValue js_quickjs::get_length(JSContext* ctx, JSValueConst val)
+{
+    heap_stash* stash = get_heap_stash(ctx);
+
+    if(!stash)
+        return JS_GetPropertyStr(ctx, val, "length");
+
+    return JS_GetProperty(ctx, val, stash->length_atom);
+}
+
+uint32_t js_quickjs::get_element_count(JSContext* ctx, JSValueConst val)
+{
+    JSValue jslen = get_length(ctx, val);
+
+    if(JS_IsException(jslen))
+        throw_exception(ctx, jslen);
+
+    ///array lengths are always valid uint32s, but array likes can claim anything
+    double len = 0;
+    int res = JS_ToFloat64(ctx, &len, jslen);
+
+    JS_FreeValue(ctx, jslen);
+
+    if(res < 0)
+        throw_exception(ctx, JS_UNDEFINED);
+
+    if(std::isnan(len) || len <= 0)
+        return 0;
+
+    if(len > max_array_length)
+        throw std::runtime_error("Array length " + std::to_string(len) + " exceeds max_array_length");
+
+    return (uint32_t)len;
+}
+
+const JSAtom* js_quickjs::get_reflected_atoms(JSContext* ctx, const void* type_tag, const char* const* names, size_t count)
+{
+    heap_stash* stash = get_heap_stash(ctx);
+
+    if(!stash)
+        throw std::runtime_error("No heap stash for reflected type");
+
+    if(auto it = stash->reflected_atoms.find(type_tag); it != stash->reflected_atoms.end())
+        return it->second.data();
+
+    std::vector<JSAtom> atoms;
+
+    for(size_t i=0; i < count; i++)
+    {
+        JSAtom atom = JS_NewAtom(ctx, names[i]);
+
+        if(atom == JS_ATOM_NULL)
+        {
+            for(JSAtom a : atoms)
+                JS_FreeAtom(ctx, a);
+
+            throw std::runtime_error("Could not allocate atom");
+        }
+
+        atoms.push_back(atom);
+    }
+
+    return stash->reflected_atoms.emplace(type_tag, std::move(atoms)).first->second.data();
+}
+
+bool js_quickjs::get_typed_array_data(JSContext* ctx, JSValueConst val, const char* ctor_name, uint8_t*& data, size_t& bytes)
+{
+    if(!JS_IsObject(val))
+        return false;
+
+    JSValue ctor = get_typed_array_ctor(ctx, ctor_name);
+
+    if(JS_IsException(ctor))
+        js_quickjs::throw_exception(ctx, ctor);
+
+    int is_kind = JS_IsInstanceOf(ctx, val, ctor);
+
+    JS_FreeValue(ctx, ctor);
+
+    if(is_kind < 0)
+        js_quickjs::throw_exception(ctx, JS_UNDEFINED);
+
+    if(is_kind == 0)
+        return false;
+
+    size_t byte_offset = 0;
+    size_t byte_length = 0;
+    size_t bytes_per_element = 0;
+
+    JSValue buffer = JS_GetTypedArrayBuffer(ctx, val, &byte_offset, &byte_length, &bytes_per_element);
+
+    ///something that inherits from a typed array prototype without being one
+    if(JS_IsException(buffer))
+    {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        return false;
+    }
+
+    size_t buffer_size = 0;
+    uint8_t* ptr = JS_GetArrayBuffer(ctx, &buffer_size, buffer);
+
+    JS_FreeValue(ctx, buffer);
+
+    if(ptr == nullptr)
+        js_quickjs::throw_exception(ctx, JS_UNDEFINED, "Detached ArrayBuffer");
+
+    data = ptr + byte_offset;
+    bytes = byte_length;
+
+    return true;
+}
+
+static void free_external_buffer(JSRuntime* rt, void* opaque, void* ptr)
+{
+    std::function<void()>* on_free = (std::function<void()>*)opaque;
+
+    if(*on_free)
+        (*on_free)();
+
+    delete on_free;
+}
+
+js_quickjs::value js_quickjs::make_external_buffer(js_quickjs::value_context& vctx, uint8_t* data, size_t bytes, std::function<void()> on_free)
+{
+    std::function<void()>* opaque = new std::function<void()>(std::move(on_free));
+
+    JSValue buf = JS_NewArrayBuffer(vctx.ctx, data, bytes, free_external_buffer, opaque, false);
+
+    if(JS_IsException(buf))
+    {
+        delete opaque;
+        throw_exception(vctx.ctx, buf);
+    }
+
+    js_quickjs::value ret(vctx);
+    ret = buf;
+
+    JS_FreeValue(vctx.ctx, buf);
+
+    return ret;
+}
+
+JSValue js_quickjs::args::push(JSContext* ctx, const nlohmann::json& in)
+{
+    return json_to_js(ctx, in, js_quickjs::max_json_depth);
+}
+
+JSValue js_quickjs::args::push(JSContext* ctx, const js_quickjs::value& in)
+{
+    if(!in.has_value)
+        return JS_UNDEFINED;
+
+    return JS_DupValue(ctx, in.val);
+}
+
+void js_quickjs::args::get(js_quickjs::value_context& vctx, const JSValue& val, js_quickjs::value& out)
+{
+    if(JS_IsUndefined(val))
+        return;
+
+    out = val;
+}
+
+void js_quickjs::args::get(js_quickjs::value_context& vctx, const JSValue& val, std::vector<std::pair<js_quickjs::value, js_quickjs::value>>& out)
+{
+    UNDEF();
+
+    JSPropertyEnum* names = nullptr;
+    uint32_t len = 0;
+
+    JS_GetOwnPropertyNames(vctx.ctx, &names, &len, val, JS_GPN_STRING_MASK|JS_GPN_SYMBOL_MASK);
+
+    if(names == nullptr)
+    {
+        out.clear();
+        return;
+    }
+
+    for(uint32_t i=0; i < len; i++)
+    {
+        JSAtom atom = names[i].atom;
+
+        if(atom == JS_ATOM_NULL)
+            throw std::runtime_error("Likely oom in args::get");
+
+        JSValue found = JS_GetProperty(vctx.ctx, val, atom);
+
+        if(JS_IsException(found))
+            js_quickjs::throw_exception(vctx.ctx, found);
+
+        JSValue key = JS_AtomToValue(vctx.ctx, atom);
+
+        if(atom == JS_ATOM_NULL)
+            throw std::runtime_error("Null atom in args::get");
+
+        js_quickjs::value out_key(vctx);
+        js_quickjs::value out_value(vctx);
+
+        out_key = key;
+        out_value = found;
+
+        out.push_back({std::move(out_key), std::move(out_value)});
+
+        JS_FreeValue(vctx.ctx, found);
+        JS_FreeValue(vctx.ctx, key);
+    }
+
+    for(uint32_t i=0; i < len; i++)
+    {
+        JS_FreeAtom(vctx.ctx, names[i].atom);
+    }
+
+    js_free(vctx.ctx, names);
+}
+
+void js_quickjs::args::get(js_quickjs::value_context& vctx, const JSValue& val, std::vector<js_quickjs::value>& out)
+{
+    UNDEF();
+
+    out.clear();
+
+    uint32_t len = get_element_count(vctx.ctx, val);
+
+    out.reserve(std::min(len, max_array_reserve));
+
+    for(uint32_t i=0; i < len; i++)
+    {
+        JSValue found = JS_GetPropertyUint32(vctx.ctx, val, i);
+
+        if(JS_IsException(found))
+            throw_exception(vctx.ctx, found);
+
+        js_quickjs::value next(vctx);
+        next = found;
+
+        JS_FreeValue(vctx.ctx, found);
+
+        out.push_back(std::move(next));
+    }
+}
+
+js_quickjs::value& js_quickjs::value::operator=(const char* v)
+{
+    qstack_manager m(*this);
+
+    val = args::push(ctx, v);
+
+    return *this;
+}
+
+js_quickjs::value& js_quickjs::value::operator=(const std::string& v)
+{
+    qstack_manager m(*this);
+
+    val = args::push(ctx, v);
+
+    return *this;
+}
+
+js_quickjs::value& js_quickjs::value::operator=(int64_t v)
+{
+    qstack_manager m(*this);
+
+    val = args::push(ctx, v);
+
+    return *this;
+}
+
+js_quickjs::value& js_quickjs::value::operator=(int v)
+{
+    qstack_manager m(*this);
+
+    val = args::push(ctx, v);
+
+    return *this;
+}
+
+js_quickjs::value& js_quickjs::value::operator=(double v)
+{
+    qstack_manager m(*this);
+
+    val = args::push(ctx, v);
+
+    return *this;
+}
+
+js_quickjs::value& js_quickjs::value::operator=(bool v)
+{
+    qstack_manager m(*this);
+
+    val = args::push(ctx, v);
+
+    return *this;
+}
+
+js_quickjs::value& js_quickjs::value::operator=(std::nullopt_t v)
+{
+    if(!has_value)
+        return *this;
+
+    JS_FreeValue(ctx, val);
+    has_value = false;
+
+    if(has_parent)
+    {
+        JSAtom atom;
+
+        if(indices.index() == 1)
+            atom = JS_NewAtomUInt32(ctx, std::get<1>(indices));
+        else if(indices.index() == 2)
+            atom = JS_NewAtom(ctx, std::get<2>(indices).c_str());
+        else if(indices.index() == 3)
+            atom = JS_DupAtom(ctx, std::get<3>(indices).atom);
+        else
+            throw std::runtime_error("Bad indices");
+
+        if(atom == JS_ATOM_NULL)
+            throw std::runtime_error("Could not create atom");
+
+        JS_DeleteProperty(ctx, parent_value, atom, 0);
+
+        JS_FreeAtom(ctx, atom);
+    }
+
+    return *this;
+}
+
+js_quickjs::value& js_quickjs::value::operator=(const value& right)
+{
+    if(!has_value && !right.has_value)
+        return *this;
+
+    ///update my parent with their value
+    /*if(has_parent)
+    {
+        qstack_manager m(*this);
+
+        val = JS_DupValue(ctx, right.val);
+
+        return *this;
+    }
+    ///do normal stack management, then take parent of other value
+    else*/
+    {
+        {
+            qstack_manager m(*this);
+
+            val = JS_DupValue(ctx, right.val);
+        }
+
+        if(has_parent)
+            JS_FreeValue(ctx, parent_value);
+
+        has_parent = false;
+
+        if(right.has_parent)
+            parent_value = JS_DupValue(ctx, right.parent_value);
+
+        has_parent = right.has_parent;
+        indices = right.indices;
+
+        has_value = right.has_value;
+        released = right.released;
+
+        ctx = right.ctx;
+        vctx = right.vctx;
+
+        return *this;
+    }
+}
+
+///same semantics as copy assignment, including writing back to our parent and then adopting
+///right's parent, but steals right's references instead of duplicating them
+js_quickjs::value& js_quickjs::value::operator=(value&& right) noexcept
+{
+    if(this == &right)
+        return *this;
+
+    if(!has_value && !right.has_value)
+        return *this;
+
+    bool right_has_value = right.has_value;
+    bool right_released = right.released;
+
+    {
+        qstack_manager m(*this);
+
+        val = right.val;
+    }
+
+    right.val = JS_UNDEFINED;
+    right.has_value = false;
+    right.released = false;
+
+    if(has_parent)
+        JS_FreeValue(ctx, parent_value);
+
+    has_parent = right.has_parent;
+    parent_value = right.parent_value;
+    indices = std::move(right.indices);
+
+    right.parent_value = JS_UNDEFINED;
+    right.has_parent = false;
+
+    has_value = right_has_value;
+    released = right_released;
+
+    ctx = right.ctx;
+    vctx = right.vctx;
+
+    return *this;
+}
+
+js_quickjs::value& js_quickjs::value::operator=(js_quickjs::undefined_t)
+{
+    qstack_manager m(*this);
+
+    val = args::push(ctx, js_quickjs::undefined);
+
+    return *this;
+}
+
+js_quickjs::value& js_quickjs::value::operator=(js_quickjs::null_t)
+{
+    qstack_manager m(*this);
+
+    val = args::push(ctx, js_quickjs::null);
+
+    return *this;
+}
+
+js_quickjs::value& js_quickjs::value::operator=(const nlohmann::json& in)
+{
+    qstack_manager m(*this);
+
+    val = args::push(ctx, in);
+
+    return *this;
+}
+
+js_quickjs::value& js_quickjs::value::operator=(js_quickjs::funcptr_t in)
+{
+    qstack_manager m(*this);
+
+    val = args::push(ctx, in);
+
+    return *this;
+}
+
+js_quickjs::value& js_quickjs::value::operator=(const JSValue& in)
+{
+    qstack_manager m(*this);
+
+    val = args::push(ctx, in);
+
+    return *this;
+}
+
+void js_quickjs::value::stringify_parse()
+{
+    std::string json = to_json();
+
+    JS_FreeValue(ctx, val);
+
+    JSValue test = JS_ParseJSON(ctx, json.c_str(), json.size(), nullptr);
+
+    if(JS_IsException(test))
+        throw_exception(ctx, test);
+
+    val = test;
+}
+
+js_quickjs::value::operator std::string() const
+{
+    if(!has_value)
+        return std::string();
+
+    std::string ret;
+    args::get(*vctx, val, ret);
+
+    return ret;
+}
+
+js_quickjs::value::operator int64_t() const
+{
+    if(!has_value)
+        return int64_t();
+
+    int64_t ret;
+    args::get(*vctx, val, ret);
+
+    return ret;
+}
+
+js_quickjs::value::operator int() const
+{
+    if(!has_value)
+        return int();
+
+    int ret;
+    args::get(*vctx, val, ret);
+
+    return ret;
+}
+
+js_quickjs::value::operator double() const
+{
+    if(!has_value)
+        return double();
+
+    double ret;
+    args::get(*vctx, val, ret);
+
+    return ret;
+}
+
+js_quickjs::value::operator bool() const
+{
+    if(!has_value)
+        return bool();
+
+    bool ret;
+    args::get(*vctx, val, ret);
+
+    return ret;
+}
+
+std::vector<std::pair<js_quickjs::value, js_quickjs::value>> js_quickjs::value::iterate()
+{
+    if(!has_value)
+        return std::vector<std::pair<js_quickjs::value, js_quickjs::value>>();
+
+    std::vector<std::pair<js_quickjs::value, js_quickjs::value>> ret;
+    args::get(*vctx, val, ret);
+
+    return ret;
+}
+
+
+js_quickjs::value js_quickjs::value::operator[](int64_t arg)
+{
+    return js_quickjs::value(*vctx, *this, arg);
+}
+
+js_quickjs::value js_quickjs::value::operator[](const std::string& arg)
+{
+    return js_quickjs::value(*vctx, *this, arg);
+}
+
+js_quickjs::value js_quickjs::value::operator[](const char* arg)
+{
+    return js_quickjs::value(*vctx, *this, arg);
+}
+
+js_quickjs::value js_quickjs::value::operator[](const js_quickjs::key& arg)
+{
+    return js_quickjs::value(*vctx, *this, arg);
+}
+
+js_quickjs::value_ref js_quickjs::value::ref(const js_quickjs::key& k) const
+{
+    if(!has_value)
+        throw std::runtime_error("No value in ref");
+
+    return value_ref(*vctx, val, k);
+}
+
+js_quickjs::value_ref js_quickjs::value::ref(uint32_t idx) const
+{
+    if(!has_value)
+        throw std::runtime_error("No value in ref");
+
+    return value_ref(*vctx, val, idx);
+}
+
+js_quickjs::value_ref::value_ref(js_quickjs::value_context& _vctx, JSValueConst _parent, const js_quickjs::key& k)
+{
+    vctx = &_vctx;
+    ctx = _vctx.ctx;
+    parent = _parent;
+    atom = k.atom;
+}
+
+js_quickjs::value_ref::value_ref(js_quickjs::value_context& _vctx, JSValueConst _parent, uint32_t idx)
+{
+    vctx = &_vctx;
+    ctx = _vctx.ctx;
+    parent = _parent;
+    index = idx;
+    is_index = true;
+}
+
+js_quickjs::value_ref::~value_ref()
+{
+    JS_FreeValue(ctx, cached);
+}
+
+JSValueConst js_quickjs::value_ref::fetch() const
+{
+    if(!JS_IsUninitialized(cached))
+        return cached;
+
+    JSValue found = is_index ? JS_GetPropertyUint32(ctx, parent, index) : JS_GetProperty(ctx, parent, atom);
+
+    if(JS_IsException(found))
+        throw_exception(ctx, found);
+
+    cached = found;
+
+    return cached;
+}
+
+bool js_quickjs::value_ref::exists() const
+{
+    if(!JS_IsObject(parent))
+        return false;
+
+    if(!JS_IsUndefined(fetch()))
+        return true;
+
+    if(!is_index)
+        return JS_HasProperty(ctx, parent, atom) > 0;
+
+    JSAtom idx_atom = JS_NewAtomUInt32(ctx, index);
+
+    if(idx_atom == JS_ATOM_NULL)
+        throw std::runtime_error("Could not allocate atom");
+
+    bool present = JS_HasProperty(ctx, parent, idx_atom) > 0;
+
+    JS_FreeAtom(ctx, idx_atom);
+
+    return present;
+}
+
+js_quickjs::value js_quickjs::value_ref::get() const
+{
+    if(!exists())
+        return value(*vctx, js_quickjs::undefined);
+
+    value ret(*vctx);
+    ret = fetch();
+
+    return ret;
+}
+
+js_quickjs::value_ref js_quickjs::value_ref::operator[](const js_quickjs::key& k) const
+{
+    return value_ref(*vctx, fetch(), k);
+}
+
+js_quickjs::value_ref js_quickjs::value_ref::operator[](uint32_t idx) const
+{
+    return value_ref(*vctx, fetch(), idx);
+}
+
+void js_quickjs::value_ref::set(JSValue in)
+{
+    JS_FreeValue(ctx, cached);
+    cached = JS_UNINITIALIZED;
+
+    int ret = is_index ? JS_SetPropertyUint32(ctx, parent, index, in) : JS_SetProperty(ctx, parent, atom, in);
+
+    if(ret < 0)
+        throw_exception(ctx, JS_UNDEFINED);
+}
+
+js_quickjs::value_ref::operator std::string() const
+{
+    std::string ret;
+    args::get(*vctx, fetch(), ret);
+
+    return ret;
+}
+
+js_quickjs::value_ref::operator int64_t() const
+{
+    int64_t ret = 0;
+    args::get(*vctx, fetch(), ret);
+
+    return ret;
+}
+
+js_quickjs::value_ref::operator int() const
+{
+    int ret = 0;
+    args::get(*vctx, fetch(), ret);
+
+    return ret;
+}
+
+js_quickjs::value_ref::operator double() const
+{
+    double ret = 0;
+    args::get(*vctx, fetch(), ret);
+
+    return ret;
+}
+
+js_quickjs::value_ref::operator bool() const
+{
+    bool ret = false;
+    args::get(*vctx, fetch(), ret);
+
+    return ret;
+}
+
+nlohmann::json js_quickjs::value::to_nlohmann(int max_depth)
+{
+    if(!has_value)
+        return nlohmann::json();
+
+    js_quickjs::jsvalue_guard top(ctx, apply_to_json(ctx, JS_DupValue(ctx, val), [&](){return JS_NewString(ctx, "");}));
+
+    return js_to_json(ctx, top.val, max_depth);
+}
+
+void js_quickjs::value::from_json(const std::string& str)
+{
+    qstack_manager m(*this);
+
+    val = JS_ParseJSON(ctx, str.c_str(), str.size(), nullptr);
+}
+
+std::string js_quickjs::value::to_json()
+{
+    JSValue jval = JS_JSONStringify(ctx, val, JS_UNDEFINED, JS_UNDEFINED);
+
+    if(JS_IsException(jval))
+        throw_exception(ctx, jval);
+
+    value sval(*vctx);
+    sval = jval;
+
+    JS_FreeValue(ctx, jval);
+
+    return (std::string)sval;
+}
+
+std::string js_quickjs::value::to_error_message()
+{
+    std::string err = "Error:\n";
+
+    if(has("stack"))
+    {
+        err += "Stack: " + (std::string)get("stack");
+    }
+
+    if(has("message"))
+    {
+        err += "Message: " + (std::string)get("message") + "\n";
+    }
+
+    if(has("lineNumber"))
+    {
+        err += "lineNumber: " + (std::string)get("lineNumber");
+    }
+
+    if(has("columnNumber"))
+    {
+        err += "columnNumber: " + (std::string)get("columnNumber");
+    }
+
+    if(!is_object())
+    {
+        return "Exception: " + (std::string)*this;
+    }
+
+    return err;
+}
+
+js_quickjs::value js_quickjs::get_global(js_quickjs::value_context& vctx)
+{
+    js_quickjs::value val(vctx);
+    JSValue found = JS_GetGlobalObject(vctx.ctx);
+
+    val = found;
+
+    JS_FreeValue(vctx.ctx, found);
+
+    return val;
+}
+
+void js_quickjs::set_global(js_quickjs::value_context& vctx, const js_quickjs::value& val)
+{
+    ///UNIMPLEMENTED BUT NOT THE END OF THE WORLD
+    //JS_SetGlobal
+}
+
+js_quickjs::value js_quickjs::get_current_function(js_quickjs::value_context& vctx)
+{
+    JSValue rval = JS_GetActiveFunction(vctx.ctx);
+
+    js_quickjs::value ret(vctx);
+
+    ret = rval;
+
+    return ret;
+}
+
+js_quickjs::value js_quickjs::get_this(js_quickjs::value_context& vctx)
+{
+    return vctx.get_current_this();
+}
+
+js_quickjs::value js_quickjs::get_heap_stash(js_quickjs::value_context& vctx)
+{
+    heap_stash* stash = (heap_stash*)JS_GetRuntimeOpaque(JS_GetRuntime(vctx.ctx));
+
+    js_quickjs::value ret(vctx, js_quickjs::undefined);
+    ret = stash->heap_stash_value;
+
+    return ret;
+}
+
+js_quickjs::value js_quickjs::get_global_stash(js_quickjs::value_context& vctx)
+{
+    global_stash* stash = (global_stash*)JS_GetContextOpaque(vctx.ctx);
+
+    js_quickjs::value ret(vctx);
+    ret = stash->global_stash_value;
+
+    return ret;
+}
+
+void* js_quickjs::get_sandbox_data_impl(js_quickjs::value_context& vctx)
+{
+    heap_stash* stash = (heap_stash*)JS_GetRuntimeOpaque(JS_GetRuntime(vctx.ctx));
+
+    assert(stash->sandbox);
+
+    return (void*)stash->sandbox;
+}
+
+#if 0
+js_quickjs::value js_quickjs::add_getter(js_quickjs::value& base, const std::string& key, js_quickjs::funcptr_t func)
+{
+    js_quickjs::value val(*base.vctx);
+    val = func;
+
+    JSAtom str = JS_NewAtomLen(base.ctx, key.c_str(), key.size());
+
+    JS_DefineProperty(base.ctx, base.val, str, JS_UNDEFINED, val.val, JS_UNDEFINED, JS_PROP_HAS_GET);
+
+    JS_FreeAtom(base.ctx, str);
+
+    return val;
+}
+
+js_quickjs::value js_quickjs::add_setter(js_quickjs::value& base, const std::string& key, js_quickjs::funcptr_t func)
+{
+    js_quickjs::value val(*base.vctx);
+    val = func;
+
+    JSAtom str = JS_NewAtomLen(base.ctx, key.c_str(), key.size());
+
+    JS_DefineProperty(base.ctx, base.val, str, JS_UNDEFINED, JS_UNDEFINED, val.val, JS_PROP_HAS_SET);
+
+    JS_FreeAtom(base.ctx, str);
+
+    return val;
+}
+#endif // 0
+
+std::pair<js_quickjs::value, js_quickjs::value> js_quickjs::add_getter_setter(js_quickjs::value& base, const std::string& key, js_quickjs::funcptr_t get, js_quickjs::funcptr_t set)
+{
+    js_quickjs::value vget(*base.vctx);
+    vget = get;
+
+    js_quickjs::value vset(*base.vctx);
+    vset = set;
+
+    JSAtom str = JS_NewAtomLen(base.ctx, key.c_str(), key.size());
+
+    if(str == JS_ATOM_NULL)
+        throw std::runtime_error("Null atom in add_getter_setter");
+
+    JS_DefinePropertyGetSet(base.ctx, base.val, str, JS_DupValue(base.ctx, vget.val), JS_DupValue(base.ctx, vset.val), 0);
+
+    JS_FreeAtom(base.ctx, str);
+
+    return {std::move(vget), std::move(vset)};
+}
+
+void js_quickjs::define_native_class(JSContext* ctx, JSClassID class_id, const char* name, JSClassFinalizer* finalizer,
+                                     const std::pair<const char*, js_quickjs::funcptr_t>* methods, size_t method_count)
+{
+    JSRuntime* rt = JS_GetRuntime(ctx);
+
+    if(!JS_IsRegisteredClass(rt, class_id))
+    {
+        JSClassDef def = {};
+        def.class_name = name;
+        def.finalizer = finalizer;
+
+        if(JS_NewClass(rt, class_id, &def) < 0)
+            throw std::runtime_error("Could not register class " + std::string(name));
+    }
+
+    if(is_native_class_defined(ctx, class_id))
+        return;
+
+    JSValue proto = JS_NewObject(ctx);
+
+    if(JS_IsException(proto))
+        throw_exception(ctx, proto);
+
+    for(size_t i=0; i < method_count; i++)
+    {
+        auto& [method_name, func] = methods[i];
+
+        JSValue jfunc = JS_NewCFunction(ctx, func, method_name, 0);
+
+        if(JS_IsException(jfunc))
+        {
+            JS_FreeValue(ctx, proto);
+            throw_exception(ctx, jfunc);
+        }
+
+        JS_DefinePropertyValueStr(ctx, proto, method_name, jfunc, JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
+    }
+
+    ///takes ownership of proto
+    JS_SetClassProto(ctx, class_id, proto);
+}
+
+js_quickjs::prepared_call::prepared_call(js_quickjs::value& _func)
+{
+    JSValue glob = JS_GetGlobalObject(_func.ctx);
+
+    init(_func, glob);
+
+    JS_FreeValue(_func.ctx, glob);
+}
+
+js_quickjs::prepared_call::prepared_call(js_quickjs::value& _func, const js_quickjs::value& _this)
+{
+    init(_func, _this.val);
+}
+
+js_quickjs::prepared_call::prepared_call(js_quickjs::value& obj, const js_quickjs::key& k)
+{
+    js_quickjs::value found = obj.get(k);
+
+    init(found, obj.val);
+}
+
+void js_quickjs::prepared_call::init(js_quickjs::value& _func, JSValue _this)
+{
+    if(!_func.has_value || !JS_IsFunction(_func.ctx, _func.val))
+        throw std::runtime_error("prepared_call on something that isn't a function");
+
+    vctx = _func.vctx;
+    ctx = _func.ctx;
+    func = JS_DupValue(ctx, _func.val);
+    this_val = JS_DupValue(ctx, _this);
+}
+
+js_quickjs::prepared_call::prepared_call(js_quickjs::prepared_call&& other)
+{
+    vctx = other.vctx;
+    ctx = other.ctx;
+    func = other.func;
+    this_val = other.this_val;
+
+    other.func = JS_UNDEFINED;
+    other.this_val = JS_UNDEFINED;
+}
+
+js_quickjs::prepared_call& js_quickjs::prepared_call::operator=(js_quickjs::prepared_call&& other)
+{
+    if(this == &other)
+        return *this;
+
+    if(ctx)
+    {
+        JS_FreeValue(ctx, func);
+        JS_FreeValue(ctx, this_val);
+    }
+
+    vctx = other.vctx;
+    ctx = other.ctx;
+    func = other.func;
+    this_val = other.this_val;
+
+    other.func = JS_UNDEFINED;
+    other.this_val = JS_UNDEFINED;
+
+    return *this;
+}
+
+js_quickjs::prepared_call::~prepared_call()
+{
+    if(ctx)
+    {
+        JS_FreeValue(ctx, func);
+        JS_FreeValue(ctx, this_val);
+    }
+}
+
+void js_quickjs::set_function_list(js_quickjs::value& obj, const JSCFunctionListEntry* tab, size_t count)
+{
+    if(!obj.has_value)
+        throw std::runtime_error("No value in set_function_list");
+
+    JS_SetPropertyFunctionList(obj.ctx, obj.val, tab, (int)count);
+}
+
+void js_quickjs::set_global_function_list(js_quickjs::value_context& vctx, const JSCFunctionListEntry* tab, size_t count)
+{
+    JSValue glob = JS_GetGlobalObject(vctx.ctx);
+
+    JS_SetPropertyFunctionList(vctx.ctx, glob, tab, (int)count);
+
+    JS_FreeValue(vctx.ctx, glob);
+}
+
+static int native_module_init(JSContext* ctx, JSModuleDef* m)
+{
+    global_stash* stash = (global_stash*)JS_GetContextOpaque(ctx);
+
+    auto it = stash->native_modules.find(m);
+
+    if(it == stash->native_modules.end())
+        return -1;
+
+    return JS_SetModuleExportList(ctx, m, it->second.first, (int)it->second.second);
+}
+
+JSModuleDef* js_quickjs::new_native_module(js_quickjs::value_context& vctx, const char* name, const JSCFunctionListEntry* tab, size_t count)
+{
+    JSModuleDef* m = JS_NewCModule(vctx.ctx, name, native_module_init);
+
+    if(m == nullptr)
+        throw std::runtime_error("Could not create module " + std::string(name));
+
+    if(JS_AddModuleExportList(vctx.ctx, m, tab, (int)count) < 0)
+        throw std::runtime_error("Could not add exports to module " + std::string(name));
+
+    global_stash* stash = (global_stash*)JS_GetContextOpaque(vctx.ctx);
+
+    stash->native_modules[m] = {tab, count};
+
+    return m;
+}
+
+static JSClassID get_callable_class_id()
+{
+    static JSClassID class_id = []()
+    {
+        JSClassID ret = 0;
+        JS_NewClassID(&ret);
+        return ret;
+    }();
+
+    return class_id;
+}
+
+static void callable_finalizer(JSRuntime* rt, JSValue val)
+{
+    delete (js_quickjs::callable_base*)JS_GetOpaque(val, get_callable_class_id());
+}
+
+static void callable_gc_mark(JSRuntime* rt, JSValueConst val, JS_MarkFunc* mark_func)
+{
+    js_quickjs::callable_base* callable = (js_quickjs::callable_base*)JS_GetOpaque(val, get_callable_class_id());
+
+    if(callable)
+        callable->gc_mark(rt, mark_func);
+}
+
+static JSValue callable_trampoline(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv, int magic, JSValue* func_data)
+{
+    js_quickjs::callable_base* callable = (js_quickjs::callable_base*)JS_GetOpaque(func_data[0], get_callable_class_id());
+
+    if(callable == nullptr)
+        return JS_ThrowInternalError(ctx, "Callable already freed");
+
+    return callable->invoke(ctx, this_val, argc, argv);
+}
+
+JSValue js_quickjs::new_callable_function(JSContext* ctx, js_quickjs::callable_base* callable, int length)
+{
+    JSRuntime* rt = JS_GetRuntime(ctx);
+
+    if(!JS_IsRegisteredClass(rt, get_callable_class_id()))
+    {
+        JSClassDef def = {};
+        def.class_name = "NativeCallable";
+        def.finalizer = callable_finalizer;
+        def.gc_mark = callable_gc_mark;
+
+        if(JS_NewClass(rt, get_callable_class_id(), &def) < 0)
+        {
+            delete callable;
+            return JS_ThrowInternalError(ctx, "Could not register callable class");
+        }
+    }
+
+    ///the holder is only reachable through the function's data slot, so the callable dies with the function
+    JSValue holder = JS_NewObjectClass(ctx, get_callable_class_id());
+
+    if(JS_IsException(holder))
+    {
+        delete callable;
+        return holder;
+    }
+
+    JS_SetOpaque(holder, callable);
+
+    JSValue fn = JS_NewCFunctionData(ctx, callable_trampoline, length, 0, 1, &holder);
+
+    JS_FreeValue(ctx, holder);
+
+    return fn;
+}
+
+bool js_quickjs::is_native_class_defined(JSContext* ctx, JSClassID class_id)
+{
+    if(class_id == 0 || !JS_IsRegisteredClass(JS_GetRuntime(ctx), class_id))
+        return false;
+
+    ///a freshly registered class has a null prototype in every context
+    JSValue proto = JS_GetClassProto(ctx, class_id);
+
+    bool defined = JS_IsObject(proto);
+
+    JS_FreeValue(ctx, proto);
+
+    return defined;
+}
+
+#if 0
+JSValue js_quickjs::process_return_value(JSContext* ctx, JSValue in)
+{
+    if(JS_IsException(in))
+    {
+        JSValue except = JS_GetException(ctx);
+
+        //return JS_GetException(ctx);
+    }
+
+    /*JSContext* tctx = nullptr;
+
+    while(JS_ExecutePendingJob(JS_GetRuntime(ctx), &tctx) > 0)
+    {
+
+    }*/
+
+    return JS_DupValue(ctx, in);
+}
+#endif // 0
+
+enum promise_state
+{
+    PROMISE_PENDING,
+    PROMISE_FULFILLED,
+    PROMISE_REJECTED,
+};
+
+///the state object has a null prototype and is only ever written by definition, so script can't intercept
+///the slots through setters on Object.prototype or Array.prototype. Consumes val
+static void set_watcher_slot(JSContext* ctx, JSValueConst state, uint32_t slot, JSValue val)
+{
+    JS_DefinePropertyValueUint32(ctx, state, slot, val, JS_PROP_C_W_E);
+}
+
+static int get_watcher_state(JSContext* ctx, JSValueConst state)
+{
+    JSValue found = JS_GetPropertyUint32(ctx, state, 0);
+
+    int32_t ret = PROMISE_PENDING;
+    JS_ToInt32(ctx, &ret, found);
+
+    JS_FreeValue(ctx, found);
+
+    return ret;
+}
+
+///magic is the promise_state to record, func_data[0] the watcher's state object
+static JSValue promise_settle_callback(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv, int magic, JSValue* func_data)
+{
+    JSValueConst state = func_data[0];
+
+    ///a thenable is free to call both callbacks, or one of them repeatedly. Only the first call counts
+    if(get_watcher_state(ctx, state) != PROMISE_PENDING)
+        return JS_UNDEFINED;
+
+    set_watcher_slot(ctx, state, 0, JS_NewInt32(ctx, magic));
+    set_watcher_slot(ctx, state, 1, argc > 0 ? JS_DupValue(ctx, argv[0]) : JS_UNDEFINED);
+
+    JSValue waiter = JS_GetPropertyUint32(ctx, state, 2);
+
+    if(!JS_IsUndefined(waiter))
+    {
+        int64_t id = 0;
+        JS_ToInt64(ctx, &id, waiter);
+
+        heap_stash* stash = get_heap_stash(ctx);
+
+        if(stash && stash->promise_waiters.count(id))
+            stash->ready_waiters.push_back(id);
+    }
+
+    JS_FreeValue(ctx, waiter);
+
+    return JS_UNDEFINED;
+}
+
+js_quickjs::promise_watcher::promise_watcher(js_quickjs::value_context& _vctx)
+{
+    vctx = &_vctx;
+    ctx = _vctx.ctx;
+}
+
+js_quickjs::promise_watcher::promise_watcher(js_quickjs::value_context& _vctx, js_quickjs::value& promise) : promise_watcher(_vctx)
+{
+    watch(promise);
+}
+
+js_quickjs::promise_watcher::~promise_watcher()
+{
+    cancel_wait();
+
+    free_callbacks();
+    JS_FreeValue(ctx, state);
+}
+
+void js_quickjs::promise_watcher::free_callbacks()
+{
+    for(JSValue& v : callbacks)
+    {
+        JS_FreeValue(ctx, v);
+        v = JS_UNDEFINED;
+    }
+}
+
+void js_quickjs::promise_watcher::cancel_wait()
+{
+    if(JS_IsUndefined(state))
+        return;
+
+    JSValue waiter = JS_GetPropertyUint32(ctx, state, 2);
+
+    if(!JS_IsUndefined(waiter))
+    {
+        int64_t id = 0;
+        JS_ToInt64(ctx, &id, waiter);
+
+        heap_stash* stash = get_heap_stash(ctx);
+
+        if(stash)
+            stash->promise_waiters.erase(id);
+    }
+
+    JS_FreeValue(ctx, waiter);
+}
+
+void js_quickjs::promise_watcher::watch(js_quickjs::value& promise)
+{
+    cancel_wait();
+
+    ///a thenable may hold on to its callbacks and call them after settling, so only a genuine promise's are reused
+    bool reuse = rearmable && get_state() != PROMISE_PENDING;
+    rearmable = false;
+
+    if(reuse)
+    {
+        set_watcher_slot(ctx, state, 1, JS_UNDEFINED);
+        set_watcher_slot(ctx, state, 2, JS_UNDEFINED);
+    }
+    else
+    {
+        free_callbacks();
+
+        JS_FreeValue(ctx, state);
+        state = JS_NewObjectProto(ctx, JS_NULL);
+
+        if(JS_IsException(state))
+        {
+            state = JS_UNDEFINED;
+            throw_exception(ctx, JS_EXCEPTION);
+        }
+    }
+
+    set_watcher_slot(ctx, state, 0, JS_NewInt32(ctx, PROMISE_PENDING));
+
+    global_stash* gstash = (global_stash*)JS_GetContextOpaque(ctx);
+
+    int native = gstash ? JS_IsInstanceOf(ctx, promise.val, gstash->promise_ctor) : 0;
+
+    if(native < 0)
+        throw_exception(ctx, JS_EXCEPTION);
+
+    JSValue target = JS_UNDEFINED;
+    JSValue then = JS_UNDEFINED;
+
+    if(native)
+    {
+        ///hands a genuine promise back unchanged, and adopts anything that only inherits from Promise.prototype
+        target = JS_Call(ctx, gstash->promise_resolve, gstash->promise_ctor, 1, &promise.val);
+
+        if(JS_IsException(target))
+            throw_exception(ctx, target);
+
+        then = JS_DupValue(ctx, gstash->promise_then);
+    }
+    else
+    {
+        then = JS_GetPropertyStr(ctx, promise.val, "then");
+
+        if(JS_IsException(then))
+            throw_exception(ctx, then);
+
+        ///like await, a non thenable is treated as already fulfilled with itself
+        if(!JS_IsFunction(ctx, then))
+        {
+            JS_FreeValue(ctx, then);
+
+            set_watcher_slot(ctx, state, 0, JS_NewInt32(ctx, PROMISE_FULFILLED));
+            set_watcher_slot(ctx, state, 1, JS_DupValue(ctx, promise.val));
+            return;
+        }
+
+        target = JS_DupValue(ctx, promise.val);
+    }
+
+    if(JS_IsUndefined(callbacks[0]))
+    {
+        callbacks[0] = JS_NewCFunctionData(ctx, promise_settle_callback, 1, PROMISE_FULFILLED, 1, &state);
+        callbacks[1] = JS_NewCFunctionData(ctx, promise_settle_callback, 1, PROMISE_REJECTED, 1, &state);
+    }
+
+    JSValue ret = JS_Call(ctx, then, target, 2, callbacks);
+
+    JS_FreeValue(ctx, then);
+    JS_FreeValue(ctx, target);
+
+    if(JS_IsException(ret))
+        throw_exception(ctx, ret);
+
+    JS_FreeValue(ctx, ret);
+
+    rearmable = native;
+}
+
+int js_quickjs::promise_watcher::get_state()
+{
+    if(JS_IsUndefined(state))
+        return PROMISE_PENDING;
+
+    return get_watcher_state(ctx, state);
+}
+
+bool js_quickjs::promise_watcher::is_settled()
+{
+    return get_state() != PROMISE_PENDING;
+}
+
+bool js_quickjs::promise_watcher::is_rejected()
+{
+    return get_state() == PROMISE_REJECTED;
+}
+
+js_quickjs::value js_quickjs::promise_watcher::get_result()
+{
+    js_quickjs::value ret(*vctx);
+    ret = js_quickjs::undefined;
+
+    if(!is_settled())
+        return ret;
+
+    JSValue found = JS_GetPropertyUint32(ctx, state, 1);
+
+    ret = found;
+
+    JS_FreeValue(ctx, found);
+
+    return ret;
+}
+
+void js_quickjs::add_promise_waiter(js_quickjs::promise_watcher& watcher, void* handle_address)
+{
+    heap_stash* stash = get_heap_stash(watcher.ctx);
+
+    if(stash == nullptr || JS_IsUndefined(watcher.state))
+        throw std::runtime_error("Can't wait on this promise");
+
+    int64_t id = ++stash->next_waiter_id;
+
+    stash->promise_waiters[id] = handle_address;
+
+    set_watcher_slot(watcher.ctx, watcher.state, 2, JS_NewInt64(watcher.ctx, id));
+}
+
+///eventfd backed on linux, a condition variable elsewhere
+struct js_quickjs::event_waker
+{
+    int fd = -1;
+    std::mutex mut;
+    std::condition_variable cv;
+    bool signalled = false;
+
+    event_waker()
+    {
+        #ifdef __linux__
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        #endif
+    }
+
+    ~event_waker()
+    {
+        #ifndef _WIN32
+        if(fd != -1)
+            close(fd);
+        #endif
+    }
+
+    ///may be called from any thread
+    void wake()
+    {
+        #ifdef __linux__
+        if(fd != -1)
+        {
+            uint64_t one = 1;
+            ssize_t written = write(fd, &one, sizeof(one));
+            (void)written;
+            return;
+        }
+        #endif
+
+        {
+            std::lock_guard guard(mut);
+            signalled = true;
+        }
+
+        cv.notify_one();
+    }
+
+    void wait(std::optional<std::chrono::milliseconds> timeout)
+    {
+        #ifdef __linux__
+        if(fd != -1)
+        {
+            pollfd pfd = {};
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+
+            poll(&pfd, 1, timeout.has_value() ? (int)timeout->count() : -1);
+
+            uint64_t count = 0;
+            ssize_t got = read(fd, &count, sizeof(count));
+            (void)got;
+            return;
+        }
+        #endif
+
+        std::unique_lock guard(mut);
+
+        if(timeout.has_value())
+            cv.wait_for(guard, *timeout, [&](){return signalled;});
+        else
+            cv.wait(guard, [&](){return signalled;});
+
+        signalled = false;
+    }
+
+    ///clears a pending wake without blocking, for hosts that poll fd themselves and never call wait
+    void drain()
+    {
+        #ifdef __linux__
+        if(fd != -1)
+        {
+            uint64_t count = 0;
+            ssize_t got = read(fd, &count, sizeof(count));
+            (void)got;
+            return;
+        }
+        #endif
+
+        std::lock_guard guard(mut);
+        signalled = false;
+    }
+};
+
+void js_quickjs::completion_queue::push(js_quickjs::completion* c)
+{
+    c->next = head.load(std::memory_order_relaxed);
+
+    while(!head.compare_exchange_weak(c->next, c, std::memory_order_release, std::memory_order_relaxed))
+    {
+
+    }
+
+    if(event_waker* w = waker.load(std::memory_order_acquire))
+        w->wake();
+}
+
+std::vector<js_quickjs::completion*> js_quickjs::completion_queue::take_all()
+{
+    completion* c = head.exchange(nullptr, std::memory_order_acquire);
+
+    std::vector<completion*> ret;
+
+    for(; c != nullptr; c = c->next)
+    {
+        ret.push_back(c);
+    }
+
+    ///the stack hands them back newest first
+    std::reverse(ret.begin(), ret.end());
+
+    return ret;
+}
+
+js_quickjs::completion_queue::~completion_queue()
+{
+    for(completion* c : take_all())
+    {
+        delete c;
+    }
+
+    delete waker.load();
+}
+
+void js_quickjs::completion_token::resolve()
+{
+    completion* c = new completion;
+    c->id = id;
+
+    queue->push(c);
+}
+
+void js_quickjs::completion_token::reject(const std::string& error)
+{
+    completion* c = new completion;
+    c->id = id;
+    c->success = false;
+    c->error = error;
+
+    queue->push(c);
+}
+
+std::pair<js_quickjs::value, js_quickjs::completion_token> js_quickjs::make_async_promise(js_quickjs::value_context& vctx)
+{
+    heap_stash* stash = get_heap_stash(vctx.ctx);
+
+    if(stash == nullptr)
+        throw std::runtime_error("No heap stash for async promise");
+
+    JSValue funcs[2] = {};
+
+    JSValue promise = JS_NewPromiseCapability(vctx.ctx, funcs);
+
+    if(JS_IsException(promise))
+        throw_exception(vctx.ctx, promise);
+
+    int64_t id = ++stash->next_async_id;
+
+    stash->pending_async[id] = {funcs[0], funcs[1]};
+
+    js_quickjs::value ret(vctx);
+    ret = promise;
+
+    JS_FreeValue(vctx.ctx, promise);
+
+    completion_token token;
+    token.queue = stash->completions;
+    token.id = id;
+
+    return {std::move(ret), std::move(token)};
+}
+
+js_quickjs::thread_pool::thread_pool(int threads)
+{
+    for(int i=0; i < std::max(threads, 1); i++)
+    {
+        workers.emplace_back([this]()
+        {
+            while(1)
+            {
+                std::function<void()> task;
+
+                {
+                    std::unique_lock guard(mut);
+
+                    cv.wait(guard, [&](){return stopping || !tasks.empty();});
+
+                    if(tasks.empty())
+                        return;
+
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+
+                task();
+            }
+        });
+    }
+}
+
+js_quickjs::thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard guard(mut);
+        stopping = true;
+    }
+
+    cv.notify_all();
+
+    for(std::thread& t : workers)
+    {
+        t.join();
+    }
+}
+
+void js_quickjs::thread_pool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard guard(mut);
+        tasks.push_back(std::move(task));
+    }
+
+    cv.notify_one();
+}
+
+js_quickjs::thread_pool& js_quickjs::get_async_pool()
+{
+    static thread_pool pool((int)std::thread::hardware_concurrency());
+
+    return pool;
+}
+
+///setTimeout's limit in browsers, longer delays fire almost immediately rather than overflowing the due time
+static constexpr int64_t max_timer_delay = 2147483647;
+
+static js_quickjs::event_loop* get_event_loop(JSContext* ctx)
+{
+    heap_stash* stash = get_heap_stash(ctx);
+
+    return stash ? stash->loop : nullptr;
+}
+
+///magic is 1 for setInterval
+static JSValue js_set_timer(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv, int magic)
+{
+    js_quickjs::event_loop* loop = get_event_loop(ctx);
+
+    if(loop == nullptr)
+        return JS_ThrowInternalError(ctx, "No event loop");
+
+    if(argc < 1 || !JS_IsFunction(ctx, argv[0]))
+        return JS_ThrowTypeError(ctx, "Timer callback is not a function");
+
+    double delay = 0;
+
+    if(argc > 1 && JS_ToFloat64(ctx, &delay, argv[1]))
+        return JS_EXCEPTION;
+
+    ///NaN is 0, and huge values are clamped here so the conversion to int64 is defined
+    if(!(delay > 0))
+        delay = 0;
+    else if(delay > max_timer_delay)
+        delay = 1;
+
+    std::vector<JSValue> extra;
+
+    for(int i=2; i < argc; i++)
+    {
+        extra.push_back(JS_DupValue(ctx, argv[i]));
+    }
+
+    int64_t id = loop->add_timer(JS_DupValue(ctx, argv[0]), std::move(extra), (int64_t)delay, magic == 1);
+
+    return JS_NewInt64(ctx, id);
+}
+
+static JSValue js_clear_timer(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv)
+{
+    js_quickjs::event_loop* loop = get_event_loop(ctx);
+
+    if(loop == nullptr || argc < 1)
+        return JS_UNDEFINED;
+
+    int64_t id = 0;
+    JS_ToInt64(ctx, &id, argv[0]);
+
+    loop->remove_timer(id);
+
+    return JS_UNDEFINED;
+}
+
+static JSCFunctionListEntry timer_entry(const char* name, int magic)
+{
+    JSCFunctionListEntry ret = js_quickjs::cfunc_entry(name, 2, nullptr);
+    ret.magic = magic;
+    ret.u.func.cproto = JS_CFUNC_generic_magic;
+    ret.u.func.cfunc.generic_magic = js_set_timer;
+
+    return ret;
+}
+
+static const JSCFunctionListEntry timer_functions[] =
+{
+    timer_entry("setTimeout", 0),
+    timer_entry("setInterval", 1),
+    js_quickjs::cfunc_entry("clearTimeout", 1, js_clear_timer),
+    js_quickjs::cfunc_entry("clearInterval", 1, js_clear_timer),
+};
+
+js_quickjs::event_loop::event_loop(js_quickjs::value_context& _vctx) : vctx(_vctx)
+{
+    heap_stash* stash = get_heap_stash(vctx.ctx);
+
+    if(stash == nullptr)
+        throw std::runtime_error("No heap stash for event loop");
+
+    if(stash->loop != nullptr)
+        throw std::runtime_error("Runtime already has an event loop");
+
+    waker = stash->completions->waker.load();
+
+    ///kept by the queue after this loop is gone, so a later loop on the runtime reuses it
+    if(waker == nullptr)
+    {
+        waker = new event_waker;
+        stash->completions->waker.store(waker, std::memory_order_release);
+    }
+
+    stash->loop = this;
+
+    install_timers();
+}
+
+js_quickjs::event_loop::~event_loop()
+{
+    heap_stash* stash = get_heap_stash(vctx.ctx);
+
+    if(stash && stash->loop == this)
+        stash->loop = nullptr;
+
+    clear_timers();
+}
+
+void js_quickjs::event_loop::clear_timers()
+{
+    for(auto& [id, t] : timers)
+    {
+        free_timer(t);
+    }
+
+    timers.clear();
+    timer_heap.clear();
+}
+
+void js_quickjs::event_loop::install_timers()
+{
+    set_global_function_list(vctx, timer_functions);
+}
+
+void js_quickjs::event_loop::free_timer(timer& t)
+{
+    JS_FreeValue(vctx.ctx, t.func);
+
+    for(JSValue& v : t.args)
+    {
+        JS_FreeValue(vctx.ctx, v);
+    }
+}
+
+int js_quickjs::event_loop::fd()
+{
+    return waker->fd;
+}
+
+int64_t js_quickjs::event_loop::add_timer(JSValue func, std::vector<JSValue> args, int64_t delay_ms, bool repeat)
+{
+    delay_ms = std::max(delay_ms, (int64_t)0);
+
+    if(delay_ms > max_timer_delay)
+        delay_ms = 1;
+
+    ///a 0ms interval would never let the loop go idle between runs
+    if(repeat)
+        delay_ms = std::max(delay_ms, (int64_t)1);
+
+    timer t;
+    t.func = func;
+    t.args = std::move(args);
+    t.interval_ms = delay_ms;
+    t.repeat = repeat;
+    t.due = clock::now() + std::chrono::milliseconds(delay_ms);
+
+    int64_t id = ++next_timer_id;
+
+    timer_heap.push_back({t.due, id});
+    std::push_heap(timer_heap.begin(), timer_heap.end(), std::greater<>());
+
+    timers[id] = std::move(t);
+
+    return id;
+}
+
+void js_quickjs::event_loop::remove_timer(int64_t id)
+{
+    auto it = timers.find(id);
+
+    if(it == timers.end())
+        return;
+
+    free_timer(it->second);
+    timers.erase(it);
+}
+
+std::optional<std::chrono::milliseconds> js_quickjs::event_loop::next_timeout()
+{
+    while(timer_heap.size() > 0)
+    {
+        auto [due, id] = timer_heap.front();
+
+        auto it = timers.find(id);
+
+        if(it != timers.end() && it->second.due == due)
+        {
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(due - clock::now());
+
+            return std::max(remaining, std::chrono::milliseconds(0));
+        }
+
+        std::pop_heap(timer_heap.begin(), timer_heap.end(), std::greater<>());
+        timer_heap.pop_back();
+    }
+
+    return std::nullopt;
+}
+
+bool js_quickjs::event_loop::has_work()
+{
+    heap_stash* stash = get_heap_stash(vctx.ctx);
+
+    return timers.size() > 0 || (stash && (stash->pending_async.size() > 0 || stash->ready_waiters.size() > 0));
+}
+
+bool js_quickjs::event_loop::run_once()
+{
+    ///a host multiplexing on fd() never calls wait, so the wake is consumed here or fd stays readable forever
+    waker->drain();
+
+    vctx.execute_jobs();
+
+    auto now = clock::now();
+
+    ///timers added by callbacks are due no earlier than now, so this can't run forever
+    while(timer_heap.size() > 0 && timer_heap.front().first <= now)
+    {
+        auto [due, id] = timer_heap.front();
+
+        std::pop_heap(timer_heap.begin(), timer_heap.end(), std::greater<>());
+        timer_heap.pop_back();
+
+        auto it = timers.find(id);
+
+        if(it == timers.end() || it->second.due != due)
+            continue;
+
+        JSValue func = JS_DupValue(vctx.ctx, it->second.func);
+        std::vector<JSValue> args;
+
+        for(JSValue& v : it->second.args)
+        {
+            args.push_back(JS_DupValue(vctx.ctx, v));
+        }
+
+        if(it->second.repeat)
+        {
+            it->second.due = now + std::chrono::milliseconds(it->second.interval_ms);
+
+            timer_heap.push_back({it->second.due, id});
+            std::push_heap(timer_heap.begin(), timer_heap.end(), std::greater<>());
+        }
+        else
+        {
+            free_timer(it->second);
+            timers.erase(it);
+        }
+
+        ///the callback may add or clear timers, so nothing from the map is held across it
+        JSValue ret = JS_Call(vctx.ctx, func, JS_UNDEFINED, (int)args.size(), args.data());
+
+        bool threw = JS_IsException(ret);
+
+        JS_FreeValue(vctx.ctx, ret);
+        JS_FreeValue(vctx.ctx, func);
+
+        for(JSValue& v : args)
+        {
+            JS_FreeValue(vctx.ctx, v);
+        }
+
+        ///an uncaught error in a timer doesn't stop the loop, but an interrupt has to
+        if(threw)
+        {
+            JSValue err = JS_GetException(vctx.ctx);
+
+            if(JS_IsUncatchableError(vctx.ctx, err))
+            {
+                JS_Throw(vctx.ctx, err);
+                throw_exception(vctx.ctx, JS_EXCEPTION);
+            }
+
+            JS_FreeValue(vctx.ctx, err);
+        }
+
+        vctx.execute_jobs();
+    }
+
+    return has_work();
+}
+
+void js_quickjs::event_loop::wait(std::optional<std::chrono::milliseconds> timeout)
+{
+    waker->wait(timeout);
+}
+
+void js_quickjs::event_loop::run_until_idle()
+{
+    while(run_once())
+    {
+        wait(next_timeout());
+    }
+}
+
+bool js_quickjs::event_loop::run_for(std::chrono::milliseconds duration)
+{
+    auto deadline = clock::now() + duration;
+
+    while(run_once())
+    {
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - clock::now());
+
+        if(remaining <= std::chrono::milliseconds(0))
+            return true;
+
+        std::optional<std::chrono::milliseconds> timeout = next_timeout();
+
+        wait(timeout.has_value() ? std::min(*timeout, remaining) : remaining);
+    }
+
+    return false;
+}
+
+#ifdef __cpp_impl_coroutine
+js_quickjs::value js_quickjs::promise_awaiter::await_resume()
+{
+    js_quickjs::value ret = watcher.get_result();
+
+    if(watcher.is_rejected() || ret.is_error())
+        return js_quickjs::make_error(*watcher.vctx, ret.to_error_message());
+
+    return ret;
+}
+#endif // __cpp_impl_coroutine
+
+js_quickjs::value js_quickjs::execute_promises(js_quickjs::value_context& vctx, js_quickjs::value& potential_promise)
+{
+    js_quickjs::value js_val = potential_promise;
+
+    if(js_val.has("then"))
+    {
+        js_quickjs::promise_watcher watcher(vctx, js_val);
+
+        vctx.execute_jobs();
+
+        js_val = watcher.get_result();
+        bool is_err = !watcher.is_settled() || watcher.is_rejected();
+
+        if(js_val.is_exception() || js_val.is_error() || is_err)
+        {
+            js_val = js_quickjs::make_error(vctx, js_val.to_error_message());
+        }
+    }
+    else
+    {
+        vctx.execute_jobs();
+    }
+
+    return js_val;
+}
+
+std::pair<bool, js_quickjs::value> js_quickjs::call_compiled(value& bitcode)
+{
+    JSValue ret = JS_EvalFunction(bitcode.ctx, JS_DupValue(bitcode.ctx, bitcode.val));
+
+    if(JS_IsException(ret))
+        throw_exception(bitcode.ctx, ret);
+
+    bool err = JS_IsError(bitcode.ctx, ret);
+
+    value rval(*bitcode.vctx);
+    rval = ret;
+
+    JS_FreeValue(bitcode.ctx, ret);
+
+    return {!err, std::move(rval)};
+}
+
+std::pair<bool, js_quickjs::value> js_quickjs::compile(value_context& vctx, const std::string& data)
+{
+    return compile(vctx, data, "unnamed");
+}
+
+std::pair<bool, js_quickjs::value> js_quickjs::compile(value_context& vctx, const std::string& data, const std::string& name)
+{
+    JSValue ret = JS_Eval(vctx.ctx, data.c_str(), data.size(), name.c_str(), JS_EVAL_FLAG_COMPILE_ONLY | JS_EVAL_FLAG_STRIP);
+
+    if(JS_IsException(ret))
+        throw_exception(vctx.ctx, ret);
+
+    js_quickjs::value val(vctx);
+    val = ret;
+
+    JS_FreeValue(vctx.ctx, ret);
+
+    bool err = JS_IsError(vctx.ctx, val.val);
+    return {!err, std::move(val)};
+}
+
+namespace js_quickjs
+{
+
+static std::string write_bytecode(JSContext* ctx, JSValueConst val)
+{
+    size_t size = 0;
+    uint8_t* out = JS_WriteObject(ctx, &size, val, JS_WRITE_OBJ_BYTECODE);
+
+    if(out == nullptr)
+        throw_exception(ctx, JS_UNDEFINED, "write_bytecode");
+
+    std::string ret(out, out + size);
+
+    js_free(ctx, out);
+
+    return ret;
+}
+
+std::string dump_function(value& val)
+{
+    return write_bytecode(val.ctx, val.val);
+}
+
+value eval(value_context& vctx, const std::string& data, const std::string& name)
+{
+    JSValue ret = JS_Eval(vctx.ctx, data.c_str(), data.size(), name.c_str(), 0);
+
+    if(JS_IsException(ret))
+        throw_exception(vctx.ctx, ret, name);
+
+    value rval(vctx);
+    rval = ret;
+
+    JS_FreeValue(vctx.ctx, ret);
+
+    return rval;
+}
+
+value eval_module(value_context& vctx, const std::string& data, const std::string& name)
+{
+    JSValue ret = JS_Eval(vctx.ctx, data.c_str(), data.size(), name.c_str(), JS_EVAL_TYPE_MODULE);
+
+    if(JS_IsException(ret))
+        throw_exception(vctx.ctx, ret, name);
+
+    value rval(vctx);
+    rval = ret;
+
+    JS_FreeValue(vctx.ctx, ret);
+
+    return rval;
+}
+
+value compile_module(value_context& vctx, const std::string& data, const std::string& name)
+{
+    JSValue ret = JS_Eval(vctx.ctx, data.c_str(), data.size(), name.c_str(), JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+
+    if(JS_IsException(ret))
+        throw_exception(vctx.ctx, ret, name);
+
+    value rval(vctx);
+    rval = ret;
+
+    JS_FreeValue(vctx.ctx, ret);
+
+    return rval;
+}
+
+bytecode_cache::bytecode_cache(size_t _max_bytes)
+{
+    max_bytes = _max_bytes;
+}
+
+bytecode_cache::key bytecode_cache::make_key(const std::string& data, const std::string& name, int flags)
+{
+    key k;
+    k.hash = std::hash<std::string_view>()(data);
+    k.source_size = data.size();
+    k.flags = flags;
+    k.name = name;
+
+    return k;
+}
+
+std::shared_ptr<const std::string> bytecode_cache::find(const key& k, std::string_view source)
+{
+    std::lock_guard guard(mut);
+
+    auto it = lookup.find(k);
+
+    if(it == lookup.end() || it->second->source != source)
+    {
+        cache_stats.misses++;
+        return nullptr;
+    }
+
+    cache_stats.hits++;
+
+    lru.splice(lru.begin(), lru, it->second);
+
+    return it->second->bytecode;
+}
+
+void bytecode_cache::insert(const key& k, std::string source, std::string bytecode)
+{
+    std::lock_guard guard(mut);
+
+    ///a single entry larger than the whole cache would just evict everything
+    if(source.size() + bytecode.size() > max_bytes)
+        return;
+
+    ///a hash collision replaces the older entry
+    if(auto it = lookup.find(k); it != lookup.end())
+    {
+        cache_stats.bytes -= it->second->size();
+        lru.erase(it->second);
+        lookup.erase(it);
+    }
+
+    lru.push_front({k, std::move(source), std::make_shared<const std::string>(std::move(bytecode))});
+    lookup[k] = lru.begin();
+
+    cache_stats.bytes += lru.front().size();
+
+    while(cache_stats.bytes > max_bytes && lru.size() > 0)
+    {
+        entry& last = lru.back();
+
+        cache_stats.bytes -= last.size();
+        cache_stats.evictions++;
+
+        lookup.erase(last.k);
+        lru.pop_back();
+    }
+
+    cache_stats.entries = lru.size();
+}
+
+void bytecode_cache::clear()
+{
+    std::lock_guard guard(mut);
+
+    lru.clear();
+    lookup.clear();
+
+    cache_stats.bytes = 0;
+    cache_stats.entries = 0;
+}
+
+bytecode_cache::stats bytecode_cache::get_stats()
+{
+    std::lock_guard guard(mut);
+
+    return cache_stats;
+}
+
+///returns a compiled but unevaluated function or module, reviving it from the cache if possible
+static JSValue compile_cached(value_context& vctx, bytecode_cache& cache, const std::string& data, const std::string& name, int flags)
+{
+    bytecode_cache::key k = bytecode_cache::make_key(data, name, flags);
+
+    if(std::shared_ptr<const std::string> found = cache.find(k, data); found)
+    {
+        JSValue ret = JS_ReadObject(vctx.ctx, (const uint8_t*)found->data(), found->size(), JS_READ_OBJ_BYTECODE);
+
+        if(JS_IsException(ret))
+            throw_exception(vctx.ctx, ret, name);
+
+        if((flags & JS_EVAL_TYPE_MODULE) && JS_ResolveModule(vctx.ctx, ret) < 0)
+            throw_exception(vctx.ctx, ret, name);
+
+        return ret;
+    }
+
+    JSValue ret = JS_Eval(vctx.ctx, data.c_str(), data.size(), name.c_str(), flags | JS_EVAL_FLAG_COMPILE_ONLY);
+
+    if(JS_IsException(ret))
+        throw_exception(vctx.ctx, ret, name);
+
+    cache.insert(k, data, write_bytecode(vctx.ctx, ret));
+
+    return ret;
+}
+
+std::pair<bool, value> compile(value_context& vctx, bytecode_cache& cache, const std::string& data, const std::string& name)
+{
+    JSValue ret = compile_cached(vctx, cache, data, name, JS_EVAL_FLAG_STRIP);
+
+    value val(vctx);
+    val = ret;
+
+    JS_FreeValue(vctx.ctx, ret);
+
+    bool err = JS_IsError(vctx.ctx, val.val);
+    return {!err, std::move(val)};
+}
+
+value eval(value_context& vctx, bytecode_cache& cache, const std::string& data, const std::string& name)
+{
+    JSValue func = compile_cached(vctx, cache, data, name, 0);
+
+    JSValue ret = JS_EvalFunction(vctx.ctx, func);
+
+    if(JS_IsException(ret))
+        throw_exception(vctx.ctx, ret, name);
+
+    value rval(vctx);
+    rval = ret;
+
+    JS_FreeValue(vctx.ctx, ret);
+
+    return rval;
+}
+
+value compile_module(value_context& vctx, bytecode_cache& cache, const std::string& data, const std::string& name)
+{
+    JSValue ret = compile_cached(vctx, cache, data, name, JS_EVAL_TYPE_MODULE);
+
+    value rval(vctx);
+    rval = ret;
+
+    JS_FreeValue(vctx.ctx, ret);
+
+    return rval;
+}
+
+value load_function(value_context& vctx, const std::string& bytecode)
+{
+    return load_function(vctx, (const uint8_t*)bytecode.data(), bytecode.size());
+}
+
+value load_function(value_context& vctx, const uint8_t* data, size_t size)
+{
+    JSValue ret = JS_ReadObject(vctx.ctx, data, size, JS_READ_OBJ_BYTECODE);
+
+    if(JS_IsException(ret))
+        throw_exception(vctx.ctx, ret, "load_function");
+
+    if(JS_VALUE_GET_TAG(ret) == JS_TAG_MODULE && JS_ResolveModule(vctx.ctx, ret) < 0)
+        throw_exception(vctx.ctx, ret, "load_function");
+
+    value rval(vctx);
+    rval = ret;
+
+    JS_FreeValue(vctx.ctx, ret);
+
+    return rval;
+}
+
+static uint64_t fnv1a(const uint8_t* data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for(size_t i=0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+static void write_le(uint8_t* out, uint64_t val, int bytes)
+{
+    for(int i=0; i < bytes; i++)
+    {
+        out[i] = (val >> (i * 8)) & 0xff;
+    }
+}
+
+static uint64_t read_le(const uint8_t* in, int bytes)
+{
+    uint64_t val = 0;
+
+    for(int i=0; i < bytes; i++)
+    {
+        val |= (uint64_t)in[i] << (i * 8);
+    }
+
+    return val;
+}
+
+static void write_header(uint8_t* out, const bytecode_bundle::header& h)
+{
+    write_le(out + 0, h.magic, 4);
+    write_le(out + 4, h.version, 4);
+    write_le(out + 8, h.entry_count, 4);
+    write_le(out + 12, h.reserved, 4);
+    write_le(out + 16, h.checksum, 8);
+}
+
+static bytecode_bundle::header read_header(const uint8_t* in)
+{
+    bytecode_bundle::header h;
+    h.magic = read_le(in + 0, 4);
+    h.version = read_le(in + 4, 4);
+    h.entry_count = read_le(in + 8, 4);
+    h.reserved = read_le(in + 12, 4);
+    h.checksum = read_le(in + 16, 8);
+
+    return h;
+}
+
+static void write_index_entry(uint8_t* out, const bytecode_bundle::index_entry& e)
+{
+    write_le(out + 0, e.kind, 4);
+    write_le(out + 4, e.name_size, 4);
+    write_le(out + 8, e.name_offset, 8);
+    write_le(out + 16, e.data_offset, 8);
+    write_le(out + 24, e.data_size, 8);
+}
+
+static bytecode_bundle::index_entry read_index_entry(const uint8_t* in)
+{
+    bytecode_bundle::index_entry e;
+    e.kind = read_le(in + 0, 4);
+    e.name_size = read_le(in + 4, 4);
+    e.name_offset = read_le(in + 8, 8);
+    e.data_offset = read_le(in + 16, 8);
+    e.data_size = read_le(in + 24, 8);
+
+    return e;
+}
+
+std::string bytecode_bundle::write(const std::vector<source>& sources)
+{
+    size_t blob_start = header_size + index_entry_size * sources.size();
+    size_t total = blob_start;
+
+    std::set<std::string_view> seen;
+
+    for(const source& src : sources)
+    {
+        if(!seen.insert(src.name).second)
+            throw std::runtime_error("Duplicate bundle entry " + src.name);
+
+        total += src.name.size() + src.bytecode.size();
+    }
+
+    std::string out(total, '\0');
+
+    size_t blob_offset = blob_start;
+
+    for(int i=0; i < (int)sources.size(); i++)
+    {
+        const source& src = sources[i];
+
+        index_entry e;
+        e.kind = src.kind;
+        e.name_size = src.name.size();
+        e.name_offset = blob_offset;
+        e.data_offset = blob_offset + src.name.size();
+        e.data_size = src.bytecode.size();
+
+        write_index_entry((uint8_t*)out.data() + header_size + index_entry_size * i, e);
+        memcpy(out.data() + e.name_offset, src.name.data(), src.name.size());
+        memcpy(out.data() + e.data_offset, src.bytecode.data(), src.bytecode.size());
+
+        blob_offset += src.name.size() + src.bytecode.size();
+    }
+
+    header h;
+    h.magic = magic;
+    h.version = version;
+    h.entry_count = sources.size();
+    h.checksum = fnv1a((const uint8_t*)out.data() + header_size, out.size() - header_size);
+
+    write_header((uint8_t*)out.data(), h);
+
+    return out;
+}
+
+bytecode_bundle::bytecode_bundle(const std::string& path, bool verify)
+{
+    #ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if(file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Could not open bundle " + path);
+
+    LARGE_INTEGER size = {};
+    GetFileSizeEx(file, &size);
+
+    HANDLE map = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+
+    if(map == nullptr)
+        throw std::runtime_error("Could not map bundle " + path);
+
+    mapping = (const uint8_t*)MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(map);
+
+    if(mapping == nullptr)
+        throw std::runtime_error("Could not map bundle " + path);
+
+    mapping_size = size.QuadPart;
+    #else
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if(fd < 0)
+        throw std::runtime_error("Could not open bundle " + path);
+
+    struct stat st = {};
+
+    if(fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        throw std::runtime_error("Could not stat bundle " + path);
+    }
+
+    void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(ptr == MAP_FAILED)
+        throw std::runtime_error("Could not map bundle " + path);
+
+    mapping = (const uint8_t*)ptr;
+    mapping_size = st.st_size;
+    #endif
+
+    owns_mapping = true;
+
+    try
+    {
+        parse(verify);
+    }
+    catch(...)
+    {
+        unmap();
+        throw;
+    }
+}
+
+bytecode_bundle::bytecode_bundle(const uint8_t* data, size_t size, bool verify)
+{
+    mapping = data;
+    mapping_size = size;
+
+    parse(verify);
+}
+
+bytecode_bundle::~bytecode_bundle()
+{
+    unmap();
+}
+
+void bytecode_bundle::unmap()
+{
+    if(!owns_mapping || mapping == nullptr)
+        return;
+
+    #ifdef _WIN32
+    UnmapViewOfFile(mapping);
+    #else
+    munmap((void*)mapping, mapping_size);
+    #endif
+
+    mapping = nullptr;
+}
+
+void bytecode_bundle::parse(bool verify)
+{
+    if(mapping_size < header_size)
+        throw std::runtime_error("Bundle too small");
+
+    header h = read_header(mapping);
+
+    if(h.magic != magic)
+        throw std::runtime_error("Bad bundle magic");
+
+    if(h.version != version)
+        throw std::runtime_error("Unsupported bundle version " + std::to_string(h.version));
+
+    if((mapping_size - header_size) / index_entry_size < h.entry_count)
+        throw std::runtime_error("Bundle index out of bounds");
+
+    if(verify && fnv1a(mapping + header_size, mapping_size - header_size) != h.checksum)
+        throw std::runtime_error("Bundle checksum mismatch");
+
+    for(uint32_t i=0; i < h.entry_count; i++)
+    {
+        index_entry e = read_index_entry(mapping + header_size + index_entry_size * i);
+
+        if(e.name_offset > mapping_size || e.name_size > mapping_size - e.name_offset)
+            throw std::runtime_error("Bundle name out of bounds");
+
+        if(e.data_offset > mapping_size || e.data_size > mapping_size - e.data_offset)
+            throw std::runtime_error("Bundle data out of bounds");
+
+        if(e.kind != FUNCTION && e.kind != MODULE)
+            throw std::runtime_error("Bad bundle entry kind");
+
+        std::string_view name((const char*)mapping + e.name_offset, e.name_size);
+
+        entry found;
+        found.kind = (kind_t)e.kind;
+        found.data = mapping + e.data_offset;
+        found.size = e.data_size;
+
+        if(!index.emplace(name, found).second)
+            throw std::runtime_error("Duplicate bundle entry " + std::string(name));
+    }
+}
+
+bool bytecode_bundle::has(std::string_view name) const
+{
+    return index.find(name) != index.end();
+}
+
+value bytecode_bundle::load(value_context& vctx, std::string_view name) const
+{
+    auto it = index.find(name);
+
+    if(it == index.end())
+        throw std::runtime_error("No entry in bundle " + std::string(name));
+
+    return load_function(vctx, it->second.data, it->second.size);
+}
+
+std::vector<std::string_view> bytecode_bundle::names() const
+{
+    std::vector<std::string_view> ret;
+
+    for(auto& i : index)
+    {
+        ret.push_back(i.first);
+    }
+
+    return ret;
+}
+
+value xfer_between_contexts(value_context& destination, const value& val)
+{
+    value next(destination);
+    next = val.val;
+
+    return next;
+}
+
+value make_proxy(value& target, value& handle)
+{
+    JSValue arr[2] = {target.val, handle.val};
+
+    JSValue val = js_proxy_constructor(target.ctx, JS_UNDEFINED, 2, arr);
+
+    value ret(*target.vctx);
+    ret = val;
+
+    JS_FreeValue(target.ctx, val);
+
+    return ret;
+}
+
+
+value from_cbor(value_context& vctx, const std::vector<uint8_t>& cb);
+
+void dump_stack(value_context& vctx)
+{
+    printf("Stack tracing unimplemented\n");
+}
+}
+
+void empty_func(js_quickjs::value_context* vctx)
+{
+
+}
+
+double fast_add(int a, double b)
+{
+    return a + b;
+}
+
+std::string fast_concat(const std::string& a, std::optional<int> b)
+{
+    return a + (b.has_value() ? std::to_string(b.value()) : "none");
+}
+
+#ifdef __cpp_impl_coroutine
+///fire and forget, runs eagerly until its first suspension
+struct test_coroutine
+{
+    struct promise_type
+    {
+        test_coroutine get_return_object(){return {};}
+        std::suspend_never initial_suspend(){return {};}
+        std::suspend_never final_suspend() noexcept {return {};}
+        void return_void(){}
+        void unhandled_exception(){std::terminate();}
+    };
+};
+
+test_coroutine await_test(js_quickjs::value_context& vctx, js_quickjs::value& promise, int& out)
+{
+    js_quickjs::value result = co_await js_quickjs::await(vctx, promise);
+
+    out = result;
+}
+
+///lets an exception escape resume(), keeping the frame alive so the caller can destroy it
+struct throwing_coroutine
+{
+    struct promise_type
+    {
+        throwing_coroutine get_return_object(){return {std::coroutine_handle<promise_type>::from_promise(*this)};}
+        std::suspend_never initial_suspend(){return {};}
+        std::suspend_always final_suspend() noexcept {return {};}
+        void return_void(){}
+        void unhandled_exception(){throw;}
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+throwing_coroutine await_then_throw(js_quickjs::value_context& vctx, js_quickjs::value& promise)
+{
+    co_await js_quickjs::await(vctx, promise);
+
+    throw std::runtime_error("resumed");
+}
+#endif // __cpp_impl_coroutine
+
+int async_square(int x)
+{
+    if(x < 0)
+        throw std::runtime_error("negative");
+
+    return x * x;
+}
+
+struct bound_counter
+{
+    int count = 0;
+
+    int increment(int by)
+    {
+        count += by;
+        return count;
     }
+};
+
+static int always_interrupt(JSRuntime* rt, void* sandbox)
+{
+    return 1;
 }
 
-stack_manage::~stack_manage()
+///captures the object it's stored on, so only the cycle collector can reclaim the pair
+struct cyclic_capture
 {
-    if(sh.indices.index() == 0)
+    js_quickjs::value owner;
+    std::shared_ptr<int> alive = std::make_shared<int>(0);
+
+    int operator()()
     {
-        if(sh.idx != -1)
-            duk_replace(sh.ctx, sh.idx);
-        else
-            sh.idx = duk_get_top_index(sh.ctx);
+        return 1;
     }
-    else
+
+    void gc_mark(JSRuntime* rt, JS_MarkFunc* mark_func)
     {
-        ///replace property on parent
-        duk_put_prop(sh.ctx, sh.parent_idx);
+        JS_MarkValue(rt, owner.val, mark_func);
+    }
+};
+
+struct native_class_test
+{
+    int total = 0;
+    bool* destroyed = nullptr;
+
+    int add(js_quickjs::value_context* vctx, int amount)
+    {
+        total += amount;
+        return total;
+    }
+
+    ~native_class_test()
+    {
+        if(destroyed)
+            *destroyed = true;
+    }
+};
+
+struct reflect_test_inner
+{
+    std::string name;
+    std::vector<int> values;
+};
+
+struct reflect_test
+{
+    double x = 0;
+    int64_t y = 0;
+    reflect_test_inner inner;
+};
+
+template<>
+struct js_quickjs::reflect<reflect_test_inner>
+{
+    static constexpr auto fields = std::make_tuple(js_quickjs::field("name", &reflect_test_inner::name), js_quickjs::field("values", &reflect_test_inner::values));
+};
+
+template<>
+struct js_quickjs::reflect<reflect_test>
+{
+    static constexpr auto fields = std::make_tuple(js_quickjs::field("x", &reflect_test::x), js_quickjs::field("y", &reflect_test::y), js_quickjs::field("inner", &reflect_test::inner));
+};
+
+struct quickjs_tester
+{
+    quickjs_tester()
+    {
+        js_quickjs::value_context vctx(nullptr, nullptr);
+
+        {
+            js_quickjs::value val(vctx);
+
+            js_quickjs::value dependent(vctx, val, "hello");
+        }
+
+        {
+            js_quickjs::value val(vctx);
+            val = 1234;
+
+            assert((int)val == 1234);
+        }
+
+        {
+            js_quickjs::value root(vctx);
+            root["dep"] = "hello";
+
+            std::string found = root["dep"];
+
+            assert(found == "hello");
+        }
+
+        {
+            js_quickjs::value root(vctx);
+            root["hi"] = "hellothere";
+            root["yep"] = "test";
+            root["cat"] = 1234;
+
+            js_quickjs::value subobj(vctx);
+            subobj["further_sub"] = "nope";
+
+            root["super_sub"] = subobj;
+
+            std::string found_1 = root["hi"];
+            std::string found_2 = root["yep"];
+            std::string found_3 = root["testsub"];
+
+            assert(found_1 == "hellothere");
+            assert(found_2 == "test");
+        }
+
+        {
+            js_quickjs::value root(vctx);
+
+            root.add_hidden("hello", 1234);
+
+            assert(root.has_hidden("hello"));
+            assert(!root.has_hidden("hello2"));
+
+            int val = root.get_hidden("hello");
+
+            assert(val == 1234);
+        }
+
+        {
+            js_quickjs::value root(vctx);
+
+            root.add_hidden("hello", "yep");
+            root.add_hidden("hello2", "hurro");
+
+            std::string str = root.get_hidden("hello");
+
+            assert(str == "yep");
+        }
+
+        {
+            js_quickjs::value_context tenant(nullptr, nullptr);
+
+            js_quickjs::eval(tenant, "WeakMap.prototype.get = WeakMap.prototype.set = null; WeakMap = function(){throw new Error('hijacked');};");
+
+            {
+                js_quickjs::value root(tenant);
+
+                root.add_hidden("hello", 1234);
+
+                assert((int)root.get_hidden("hello") == 1234);
+            }
+
+            tenant.reset();
+
+            js_quickjs::value root(tenant);
+
+            root.add_hidden("hello", 5678);
+
+            assert((int)root.get_hidden("hello") == 5678);
+        }
+
+        {
+            js_quickjs::value_context tenant(nullptr, nullptr);
+
+            ///keys cached across tenants, eg alongside a prepared_call, outlive the context they were made in
+            js_quickjs::key cached(tenant, "cached_key");
+
+            tenant.reset();
+
+            js_quickjs::key copied = cached;
+
+            js_quickjs::value root(tenant);
+            root[copied] = 5;
+
+            assert((int)root.get(cached) == 5);
+        }
+
+        {
+            js_quickjs::value root(vctx);
+            root = js_quickjs::function<empty_func>;
+
+            root.add_hidden("checky", "yes.hello");
+
+            std::string val = root.get_hidden("checky");
+
+            assert(val == "yes.hello");
+        }
+
+        {
+            js_quickjs::value root(vctx);
+
+            auto val = root.add("hello", js_quickjs::function<empty_func>);
+            val.add_hidden("testy", "hellothere");
+        }
+
+        {
+            js_quickjs::value func(vctx);
+            func = js_quickjs::function<empty_func>;
+
+            auto [success, res] = js_quickjs::call(func);
+
+            assert(success);
+        }
+
+        {
+            auto [success, res] = js_quickjs::compile(vctx, "1+1", "none");
+
+            assert(success);
+
+            ///not sure this will work for compiled scripts
+            JSValue ret = JS_EvalFunction(vctx.ctx, JS_DupValue(vctx.ctx, res.val));
+
+            bool err = JS_IsError(vctx.ctx, ret) || JS_IsException(ret);
+
+            JS_FreeValue(vctx.ctx, ret);
+
+            assert(!err);
+        }
+
+        {
+            js_quickjs::value root(vctx);
+
+            root.add("Hello", "1234");
+
+            assert(root.has("Hello"));
+
+            std::string val = root.get("Hello");
+
+            assert(val == "1234");
+        }
+
+        {
+            js_quickjs::value root(vctx);
+
+            std::vector<std::string> val{"hi", "hello"};
+
+            root = val;
+
+            std::vector<std::string> rval = root;
+
+            assert(rval.size() == 2);
+
+            assert(rval[0] == "hi");
+            assert(rval[1] == "hello");
+        }
+
+        {
+            int some_ptr = 0;
+
+            js_quickjs::value root(vctx);
+            root.set_ptr(&some_ptr);
+
+            int* fptr = root.get_ptr<int>();
+
+            assert(&some_ptr == fptr);
+
+            assert(fptr);
+
+            assert(*fptr == some_ptr);
+        }
+
+        {
+            js_quickjs::value root(vctx);
+
+            root["hi"] = "hello";
+
+            std::string json = root.to_json();
+
+            assert(json.size() > 0);
+        }
+
+        {
+            js_quickjs::value glob = js_quickjs::get_global(vctx);
+
+            glob["hi"] = "hello";
+
+            assert(glob.has("hi") && ((std::string)glob["hi"]) == "hello");
+
+            assert(glob.has("globalThis"));
+        }
+
+        {
+            js_quickjs::value_context_pool pool(1, nullptr, nullptr);
+
+            {
+                auto lease = pool.acquire();
+
+                js_quickjs::value glob = js_quickjs::get_global(*lease);
+                glob["tenant_global"] = 1234;
+
+                js_quickjs::value root(*lease);
+                root.add_hidden("hello", 1234);
 
-        ///update stack object as well
-        if(sh.indices.index() == 1)
-            duk_push_int(sh.ctx, std::get<1>(sh.indices));
-        else
-            duk_push_string(sh.ctx, std::get<2>(sh.indices).c_str());
+                js_quickjs::eval(*lease, "var tenant_var = 1; function tenant_fn(){} let tenant_let = 2; Array.prototype.tenant_patch = 3;");
+            }
 
-        duk_get_prop(sh.ctx, sh.parent_idx);
+            {
+                auto lease = pool.acquire();
 
-        if(sh.idx != -1)
-            duk_replace(sh.ctx, sh.idx);
-        else
-            sh.idx = duk_get_top_index(sh.ctx);
-    }
-}*/
+                js_quickjs::value glob = js_quickjs::get_global(*lease);
 
-js_quickjs::qstack_manager::qstack_manager(js_quickjs::value& _val) : val(_val)
-{
-    if(val.has_value)
-    {
-        JS_FreeValue(val.ctx, val.val);
-    }
-}
+                assert(!glob.has("tenant_global"));
+                assert(glob.has("globalThis"));
 
-///not exactly the same behaviour of duktape
-///if i replace a parent object in duktape, children will relocate to that parent index
-///here its actually object-y, so they'll refer to the old object
-js_quickjs::qstack_manager::~qstack_manager()
-{
-    val.has_value = true;
+                std::string leftovers = js_quickjs::eval(*lease, "typeof tenant_var + typeof tenant_fn + typeof tenant_let + typeof [].tenant_patch");
 
-    if(val.has_parent)
-    {
-        if(val.indices.index() == 0)
-            assert(false);
+                assert(leftovers == "undefinedundefinedundefinedundefined");
+            }
+
+            {
+                auto first = pool.acquire();
+                auto second = pool.acquire();
+            }
+
+            auto stats = pool.get_stats();
+
+            assert(stats.hits == 3);
+            assert(stats.misses == 1);
+            assert(stats.resets == 4);
+        }
 
-        if(val.indices.index() == 1)
         {
-            int idx = std::get<1>(val.indices);
+            js_quickjs::value_context_pool pool(1, nullptr, nullptr);
 
-            assert(idx >= 0);
+            {
+                auto lease = pool.acquire();
 
-            JSValue dp = JS_DupValue(val.ctx, val.val);
+                js_quickjs::eval(*lease, "function spin(){Promise.resolve().then(spin);} spin();");
+            }
 
-            JS_SetPropertyUint32(val.ctx, val.parent_value, idx, dp);
+            auto stats = pool.get_stats();
+
+            assert(stats.reset_failures == 1);
+            assert(stats.resets == 0);
         }
-        else
+
+        #ifdef __cpp_impl_coroutine
         {
-            std::string idx = std::get<2>(val.indices);
+            js_quickjs::value_context_pool pool(1, nullptr, nullptr);
 
-            JSValue dp = JS_DupValue(val.ctx, val.val);
+            js_quickjs::value_context* suspended_ctx = nullptr;
+            int result = 0;
 
-            JS_SetPropertyStr(val.ctx, val.parent_value, idx.c_str(), dp);
-        }
-    }
-}
+            {
+                auto lease = pool.acquire();
 
-JSValue js_quickjs::args::push(JSContext* ctx, const js_quickjs::value& in)
-{
-    if(!in.has_value)
-        return JS_UNDEFINED;
+                suspended_ctx = &lease.get();
 
-    return JS_DupValue(ctx, in.val);
-}
+                js_quickjs::value deferred = js_quickjs::eval(*lease, "var resolve_parked; new Promise(r => {resolve_parked = r;})");
 
-void js_quickjs::args::get(js_quickjs::value_context& vctx, const JSValue& val, js_quickjs::value& out)
-{
-    if(JS_IsUndefined(val))
-        return;
+                await_test(*lease, deferred, result);
+            }
 
-    out = val;
-}
+            auto stats = pool.get_stats();
 
-void js_quickjs::args::get(js_quickjs::value_context& vctx, const JSValue& val, std::vector<std::pair<js_quickjs::value, js_quickjs::value>>& out)
-{
-    UNDEF();
+            assert(stats.reset_failures == 1);
+            assert(stats.parked == 1);
 
-    JSPropertyEnum* names = nullptr;
-    uint32_t len = 0;
+            ///the parked context is still alive, so the coroutine can finish and the pool frees it normally
+            js_quickjs::eval(*suspended_ctx, "resolve_parked(11)");
+            suspended_ctx->execute_jobs();
 
-    JS_GetOwnPropertyNames(vctx.ctx, &names, &len, val, JS_GPN_STRING_MASK|JS_GPN_SYMBOL_MASK);
+            assert(result == 11);
+            assert(!suspended_ctx->has_promise_waiters());
 
-    if(names == nullptr)
-    {
-        out.clear();
-        return;
-    }
+            auto next = pool.acquire();
 
-    for(uint32_t i=0; i < len; i++)
-    {
-        JSAtom atom = names[i].atom;
+            assert(next.get().ctx != suspended_ctx->ctx);
+        }
+        #endif // __cpp_impl_coroutine
 
-        if(atom == JS_ATOM_NULL)
-            throw std::runtime_error("Likely oom in args::get");
+        {
+            js_quickjs::bytecode_cache cache(1024 * 1024);
 
-        JSValue found = JS_GetProperty(vctx.ctx, val, atom);
+            int first = js_quickjs::eval(vctx, cache, "20 + 22", "cached");
+            int second = js_quickjs::eval(vctx, cache, "20 + 22", "cached");
 
-        if(JS_IsException(found))
-            js_quickjs::throw_exception(vctx.ctx, found);
+            assert(first == 42);
+            assert(second == 42);
 
-        JSValue key = JS_AtomToValue(vctx.ctx, atom);
+            auto stats = cache.get_stats();
 
-        if(atom == JS_ATOM_NULL)
-            throw std::runtime_error("Null atom in args::get");
+            assert(stats.hits == 1);
+            assert(stats.misses == 1);
+            assert(stats.entries == 1);
 
-        js_quickjs::value out_key(vctx);
-        js_quickjs::value out_value(vctx);
+            ///an entry filed under a colliding key must not be handed out for different source
+            js_quickjs::bytecode_cache::key k = js_quickjs::bytecode_cache::make_key("20 + 22", "collide", 0);
 
-        out_key = key;
-        out_value = found;
+            cache.insert(k, "1 + 1", "bytes");
 
-        out.push_back({out_key, out_value});
+            assert(cache.find(k, "20 + 22") == nullptr);
+            assert(cache.find(k, "1 + 1") != nullptr);
+        }
 
-        JS_FreeValue(vctx.ctx, found);
-        JS_FreeValue(vctx.ctx, key);
-    }
+        {
+            auto [success, func] = js_quickjs::compile(vctx, "2 + 3", "bundled");
 
-    for(uint32_t i=0; i < len; i++)
-    {
-        JS_FreeAtom(vctx.ctx, names[i].atom);
-    }
+            assert(success);
 
-    js_free(vctx.ctx, names);
-}
+            std::string bundle_data = js_quickjs::bytecode_bundle::write({{"bundled", js_quickjs::bytecode_bundle::FUNCTION, js_quickjs::dump_function(func)}});
 
-void js_quickjs::args::get(js_quickjs::value_context& vctx, const JSValue& val, std::vector<js_quickjs::value>& out)
-{
-    UNDEF();
+            js_quickjs::bytecode_bundle bundle((const uint8_t*)bundle_data.data(), bundle_data.size());
 
-    out.clear();
+            assert(bundle.has("bundled"));
+            assert(!bundle.has("missing"));
 
-    JSValue jslen = JS_GetPropertyStr(vctx.ctx, val, "length");
+            js_quickjs::value loaded = bundle.load(vctx, "bundled");
 
-    if(JS_IsException(jslen))
-        throw_exception(vctx.ctx, jslen);
+            auto [call_success, result] = js_quickjs::call_compiled(loaded);
 
-    int32_t len = 0;
-    JS_ToInt32(vctx.ctx, &len, jslen);
+            assert(call_success);
+            assert((int)result == 5);
 
-    JS_FreeValue(vctx.ctx, jslen);
+            assert(bundle_data.compare(0, 4, "QJSB") == 0);
 
-    out.reserve(len);
+            std::filesystem::path path = std::filesystem::temp_directory_path() / "quickjs_cpp_test_bundle.qjsb";
 
-    for(int i=0; i < len; i++)
-    {
-        JSValue found = JS_GetPropertyUint32(vctx.ctx, val, i);
+            {
+                std::ofstream out(path, std::ios::binary);
+                out.write(bundle_data.data(), bundle_data.size());
+            }
 
-        if(JS_IsException(jslen))
-            throw_exception(vctx.ctx, jslen);
+            {
+                js_quickjs::bytecode_bundle mapped(path.string());
 
-        js_quickjs::value next(vctx);
-        next = found;
+                assert(mapped.names().size() == 1);
 
-        JS_FreeValue(vctx.ctx, found);
+                js_quickjs::value mapped_func = mapped.load(vctx, "bundled");
 
-        out.push_back(next);
-    }
-}
+                auto [mapped_success, mapped_result] = js_quickjs::call_compiled(mapped_func);
 
-js_quickjs::value& js_quickjs::value::operator=(const char* v)
-{
-    qstack_manager m(*this);
+                assert(mapped_success);
+                assert((int)mapped_result == 5);
+            }
 
-    val = args::push(ctx, v);
+            std::filesystem::remove(path);
 
-    return *this;
-}
+            bool duplicate_rejected = false;
 
-js_quickjs::value& js_quickjs::value::operator=(const std::string& v)
-{
-    qstack_manager m(*this);
+            try
+            {
+                js_quickjs::bytecode_bundle::write({{"twice", js_quickjs::bytecode_bundle::FUNCTION, "a"}, {"twice", js_quickjs::bytecode_bundle::FUNCTION, "b"}});
+            }
+            catch(std::runtime_error&)
+            {
+                duplicate_rejected = true;
+            }
 
-    val = args::push(ctx, v);
+            assert(duplicate_rejected);
+        }
 
-    return *this;
-}
+        {
+            nlohmann::json in;
+            in["str"] = "hello";
+            in["num"] = 12;
+            in["float"] = 1.5;
+            in["arr"] = {1, 2, 3};
+            in["obj"]["nested"] = true;
+            in["none"] = nullptr;
 
-js_quickjs::value& js_quickjs::value::operator=(int64_t v)
-{
-    qstack_manager m(*this);
+            js_quickjs::value root(vctx);
+            root = in;
 
-    val = args::push(ctx, v);
+            assert((std::string)root["str"] == "hello");
+            assert((int)root["arr"][1] == 2);
+            assert((bool)root["obj"]["nested"]);
 
-    return *this;
-}
+            root["func"] = js_quickjs::function<empty_func>;
 
-js_quickjs::value& js_quickjs::value::operator=(int v)
-{
-    qstack_manager m(*this);
+            nlohmann::json out = root.to_nlohmann();
 
-    val = args::push(ctx, v);
+            assert(out == in);
 
-    return *this;
-}
+            js_quickjs::value boxed = js_quickjs::eval(vctx, "({n: new Number(1), s: new String('a'), b: new Boolean(false), fake: Object.create(Number.prototype)})");
 
-js_quickjs::value& js_quickjs::value::operator=(double v)
-{
-    qstack_manager m(*this);
+            nlohmann::json unwrapped = boxed.to_nlohmann();
 
-    val = args::push(ctx, v);
+            assert(unwrapped["n"] == 1);
+            assert(unwrapped["s"] == "a");
+            assert(unwrapped["b"] == false);
+            assert(unwrapped["fake"].is_object());
 
-    return *this;
-}
+            js_quickjs::value deep = js_quickjs::eval(vctx, "[[[1]]]");
 
-js_quickjs::value& js_quickjs::value::operator=(bool v)
-{
-    qstack_manager m(*this);
+            bool too_deep = false;
 
-    val = args::push(ctx, v);
+            try
+            {
+                deep.to_nlohmann(2);
+            }
+            catch(std::runtime_error&)
+            {
+                too_deep = true;
+            }
 
-    return *this;
-}
+            assert(too_deep);
+            assert(deep.to_nlohmann(3) == nlohmann::json::parse("[[[1]]]"));
 
-js_quickjs::value& js_quickjs::value::operator=(std::nullopt_t v)
-{
-    if(!has_value)
-        return *this;
+            ///toJSON sees the member's key or index, and an undefined result drops object members like JSON.stringify
+            js_quickjs::value keyed = js_quickjs::eval(vctx, R"(
+                var keyed_to_json = {toJSON(k){return "key:" + k;}};
+                var keyed = {named: keyed_to_json, list: [keyed_to_json], hidden: {toJSON(){return undefined;}}, held: [{toJSON(){return undefined;}}]};
+                keyed
+            )");
 
-    JS_FreeValue(ctx, val);
-    has_value = false;
+            nlohmann::json keyed_out = keyed.to_nlohmann();
 
-    if(has_parent)
-    {
-        JSAtom atom;
+            std::string stringified = js_quickjs::eval(vctx, "JSON.stringify(keyed)");
 
-        if(indices.index() == 1)
-            atom = JS_NewAtomUInt32(ctx, std::get<1>(indices));
-        else if(indices.index() == 2)
-            atom = JS_NewAtom(ctx, std::get<2>(indices).c_str());
-        else
-            throw std::runtime_error("Bad indices");
+            assert(keyed_out == nlohmann::json::parse(stringified));
+            assert(keyed_out["named"] == "key:named");
+            assert(keyed_out["list"][0] == "key:0");
+            assert(!keyed_out.contains("hidden"));
+            assert(keyed_out["held"][0].is_null());
+        }
 
-        if(atom == JS_ATOM_NULL)
-            throw std::runtime_error("Could not create atom");
+        {
+            js_quickjs::key name(vctx, "name");
+            js_quickjs::key name2(vctx, "name");
 
-        JS_DeleteProperty(ctx, parent_value, atom, 0);
+            assert(name.atom == name2.atom);
 
-        JS_FreeAtom(ctx, atom);
-    }
+            js_quickjs::value root(vctx);
+            root[name] = "hello";
 
-    return *this;
-}
+            assert(root.has(name));
+            assert((std::string)root["name"] == "hello");
+            assert((std::string)root.get(name) == "hello");
 
-js_quickjs::value& js_quickjs::value::operator=(const value& right)
-{
-    if(!has_value && !right.has_value)
-        return *this;
+            root.add(name, 1234);
 
-    ///update my parent with their value
-    /*if(has_parent)
-    {
-        qstack_manager m(*this);
+            assert((int)root[name] == 1234);
 
-        val = JS_DupValue(ctx, right.val);
+            assert(root.del(name));
+            assert(!root.has(name));
+        }
 
-        return *this;
-    }
-    ///do normal stack management, then take parent of other value
-    else*/
-    {
         {
-            qstack_manager m(*this);
+            js_quickjs::value root(vctx);
+            root["undef"] = js_quickjs::undefined;
+            root["arr"] = std::vector<int>{1, 2};
 
-            val = JS_DupValue(ctx, right.val);
+            assert(!root["undef"].is_empty());
+            assert(root["undef"].is_undefined());
+            assert(root["missing"].is_empty());
+            assert(root["arr"][5].is_empty());
+            assert((int)root["arr"][1] == 2);
+
+            root["str"] = "abc";
+
+            assert((int)root["str"]["length"] == 3);
+            assert((std::string)root["str"][1] == "b");
         }
 
-        if(has_parent)
-            JS_FreeValue(ctx, parent_value);
+        {
+            js_quickjs::key outer(vctx, "outer");
+            js_quickjs::key inner(vctx, "inner");
 
-        has_parent = false;
+            js_quickjs::value root(vctx);
+            root["outer"] = js_quickjs::value(vctx);
 
-        if(right.has_parent)
-            parent_value = JS_DupValue(ctx, right.parent_value);
+            root.ref(outer)[inner] = 1234;
 
-        has_parent = right.has_parent;
-        indices = right.indices;
+            assert((int)root.ref(outer)[inner] == 1234);
+            assert((int)root["outer"]["inner"] == 1234);
+            assert(!root.ref(inner).exists());
 
-        has_value = right.has_value;
-        released = right.released;
+            js_quickjs::value owned = root.ref(outer).get();
 
-        ctx = right.ctx;
-        vctx = right.vctx;
+            assert(owned.has(inner));
+        }
 
-        return *this;
-    }
-}
+        {
+            js_quickjs::value root(vctx);
+            root["hi"] = "hello";
 
-js_quickjs::value& js_quickjs::value::operator=(js_quickjs::undefined_t)
-{
-    qstack_manager m(*this);
+            js_quickjs::value moved(std::move(root));
 
-    val = args::push(ctx, js_quickjs::undefined);
+            assert(root.is_empty());
+            assert((std::string)moved["hi"] == "hello");
 
-    return *this;
-}
+            js_quickjs::value parent(vctx);
 
-js_quickjs::value& js_quickjs::value::operator=(js_quickjs::null_t)
-{
-    qstack_manager m(*this);
+            js_quickjs::value child = parent["child"];
+            child = std::move(moved);
 
-    val = args::push(ctx, js_quickjs::null);
+            assert(moved.is_empty());
+            assert((std::string)parent["child"]["hi"] == "hello");
+        }
 
-    return *this;
-}
+        {
+            js_quickjs::value root(vctx);
+            root.add_hidden("secret", 1234);
 
-js_quickjs::value& js_quickjs::value::operator=(const nlohmann::json& in)
-{
-    qstack_manager m(*this);
+            js_quickjs::value copy = root;
 
-    val = args::push(ctx, in);
+            assert(copy.has_hidden("secret"));
+            assert((int)copy.get_hidden("secret") == 1234);
 
-    return *this;
-}
+            assert(!root.has("secret"));
+            assert(root.iterate().size() == 0);
 
-js_quickjs::value& js_quickjs::value::operator=(js_quickjs::funcptr_t in)
-{
-    qstack_manager m(*this);
+            js_quickjs::value other(vctx);
 
-    val = args::push(ctx, in);
+            assert(!other.has_hidden("secret"));
+        }
 
-    return *this;
-}
+        {
+            js_quickjs::value_context compact_ctx(nullptr, nullptr);
 
-js_quickjs::value& js_quickjs::value::operator=(const JSValue& in)
-{
-    qstack_manager m(*this);
+            {
+                js_quickjs::key k1(compact_ctx, "k1");
+                js_quickjs::key k2(compact_ctx, "k2");
+                js_quickjs::key k3(compact_ctx, "k3");
+            }
 
-    val = args::push(ctx, in);
+            ///first pass clears the referenced bits, the second frees the now unused entries
+            while(compact_ctx.compact_heap_stash(1)){}
+            while(compact_ctx.compact_heap_stash(1)){}
 
-    return *this;
-}
+            auto stats = compact_ctx.get_compact_stats();
 
-void js_quickjs::value::stringify_parse()
-{
-    std::string json = to_json();
+            assert(stats.entries_freed == 3);
+            assert(stats.last_slice_scanned == 1);
+            assert(stats.entries == 0);
+            assert(stats.passes == 2);
 
-    JS_FreeValue(ctx, val);
+            js_quickjs::key k4(compact_ctx, "k4");
 
-    JSValue test = JS_ParseJSON(ctx, json.c_str(), json.size(), nullptr);
+            ///a zero budget still makes progress
+            while(compact_ctx.compact_heap_stash(0)){}
 
-    if(JS_IsException(test))
-        throw_exception(ctx, test);
+            compact_ctx.set_auto_compact(8);
 
-    val = test;
-}
+            assert(JS_GetInterruptHandler(compact_ctx.heap) != nullptr);
 
-js_quickjs::value::operator std::string() const
-{
-    if(!has_value)
-        return std::string();
+            compact_ctx.set_auto_compact(0);
 
-    std::string ret;
-    args::get(*vctx, val, ret);
+            assert(JS_GetInterruptHandler(compact_ctx.heap) == nullptr);
+        }
 
-    return ret;
-}
+        {
+            std::vector<float> floats{1.5f, 2.5f, 3.5f};
 
-js_quickjs::value::operator int64_t() const
-{
-    if(!has_value)
-        return int64_t();
+            js_quickjs::value arr(vctx);
+            arr = floats;
 
-    int64_t ret;
-    args::get(*vctx, val, ret);
+            std::vector<float> back = arr;
 
-    return ret;
-}
+            assert(back == floats);
 
-js_quickjs::value::operator int() const
-{
-    if(!has_value)
-        return int();
+            #ifdef __cpp_lib_span
+            arr = std::span<const float>(floats);
 
-    int ret;
-    args::get(*vctx, val, ret);
+            std::span<float> view = arr.as_span<float>();
 
-    return ret;
-}
+            assert(view.size() == 3 && view[2] == 3.5f);
+            #endif
 
-js_quickjs::value::operator double() const
-{
-    if(!has_value)
-        return double();
+            bool freed = false;
 
-    double ret;
-    args::get(*vctx, val, ret);
+            {
+                auto shared = std::make_shared<std::vector<int32_t>>(std::vector<int32_t>{1, 2, 3});
 
-    return ret;
-}
+                js_quickjs::value external = js_quickjs::make_external_typed_array(vctx, shared->data(), shared->size(), [&](){freed = true;});
 
-js_quickjs::value::operator bool() const
-{
-    if(!has_value)
-        return bool();
+                external[1] = 10;
 
-    bool ret;
-    args::get(*vctx, val, ret);
+                assert((*shared)[1] == 10);
+            }
 
-    return ret;
-}
+            {
+                js_quickjs::value_context tenant(nullptr, nullptr);
 
-std::vector<std::pair<js_quickjs::value, js_quickjs::value>> js_quickjs::value::iterate()
-{
-    if(!has_value)
-        return std::vector<std::pair<js_quickjs::value, js_quickjs::value>>();
+                js_quickjs::eval(tenant, "Int32Array = function(){return {};};");
 
-    std::vector<std::pair<js_quickjs::value, js_quickjs::value>> ret;
-    args::get(*vctx, val, ret);
+                int32_t backing[2] = {4, 5};
 
-    return ret;
-}
+                js_quickjs::value external = js_quickjs::make_external_typed_array(tenant, backing, 2, [](){});
 
+                std::vector<int32_t> read = external;
 
-js_quickjs::value js_quickjs::value::operator[](int64_t arg)
-{
-    return js_quickjs::value(*vctx, *this, arg);
-}
+                assert(read.size() == 2 && read[1] == 5);
+            }
 
-js_quickjs::value js_quickjs::value::operator[](const std::string& arg)
-{
-    return js_quickjs::value(*vctx, *this, arg);
-}
+            assert(freed);
+        }
 
-js_quickjs::value js_quickjs::value::operator[](const char* arg)
-{
-    return js_quickjs::value(*vctx, *this, arg);
-}
+        {
+            std::vector<int> ints;
 
-nlohmann::json js_quickjs::value::to_nlohmann(int stack_depth)
-{
-    JSValue jval = JS_JSONStringify(ctx, val, JS_UNDEFINED, JS_UNDEFINED);
+            for(int i=0; i < 4096; i++)
+                ints.push_back(i * 3);
 
-    if(JS_IsException(jval))
-        throw_exception(ctx, jval);
+            js_quickjs::value arr(vctx);
+            arr = ints;
 
-    value sval(*vctx);
-    sval = jval;
+            std::vector<int> back = arr;
 
-    nlohmann::json ret = nlohmann::json::parse((std::string)sval);
+            assert(back == ints);
 
-    JS_FreeValue(ctx, jval);
+            std::vector<int> sparse = js_quickjs::eval(vctx, "var sparse = []; sparse[3] = 7; sparse");
 
-    return ret;
-}
+            assert(sparse.size() == 4 && sparse[0] == 0 && sparse[3] == 7);
 
-void js_quickjs::value::from_json(const std::string& str)
-{
-    qstack_manager m(*this);
+            std::vector<double> floats = js_quickjs::eval(vctx, "[0.5, 1.5, 2.5]");
+            std::vector<double> mixed = js_quickjs::eval(vctx, "[1, 2.5, '3']");
+            std::vector<int> wrapped = js_quickjs::eval(vctx, "[4294967297.0, 2.5]");
 
-    val = JS_ParseJSON(ctx, str.c_str(), str.size(), nullptr);
-}
+            assert(floats == std::vector<double>({0.5, 1.5, 2.5}));
+            assert(mixed == std::vector<double>({1, 2.5, 3}));
+            assert(wrapped == std::vector<int>({1, 2}));
 
-std::string js_quickjs::value::to_json()
-{
-    JSValue jval = JS_JSONStringify(ctx, val, JS_UNDEFINED, JS_UNDEFINED);
+            ///a throwing getter in a later batch surfaces the error, and the values already read into that batch are freed
+            bool batch_threw = false;
 
-    if(JS_IsException(jval))
-        throw_exception(ctx, jval);
+            try
+            {
+                std::vector<double> poisoned = js_quickjs::eval(vctx, "var poisoned = new Array(300).fill(1); Object.defineProperty(poisoned, 290, {get(){throw new Error('poisoned');}}); poisoned");
+            }
+            catch(std::runtime_error&)
+            {
+                batch_threw = true;
+            }
 
-    value sval(*vctx);
-    sval = jval;
+            assert(batch_threw);
 
-    JS_FreeValue(ctx, jval);
+            std::vector<int> array_like = js_quickjs::eval(vctx, "({length: 2, 0: 5, 1: 6})");
 
-    return (std::string)sval;
-}
+            assert(array_like == std::vector<int>({5, 6}));
 
-std::string js_quickjs::value::to_error_message()
-{
-    std::string err = "Error:\n";
+            for(const char* huge : {"({length: 1e300})", "var huge = []; huge.length = 4294967295; huge"})
+            {
+                bool rejected = false;
 
-    if(has("stack"))
-    {
-        err += "Stack: " + (std::string)get("stack");
-    }
+                try
+                {
+                    std::vector<double> out = js_quickjs::eval(vctx, huge);
+                }
+                catch(std::runtime_error&)
+                {
+                    rejected = true;
+                }
 
-    if(has("message"))
-    {
-        err += "Message: " + (std::string)get("message") + "\n";
-    }
+                assert(rejected);
+            }
+        }
 
-    if(has("lineNumber"))
-    {
-        err += "lineNumber: " + (std::string)get("lineNumber");
-    }
+        {
+            reflect_test in;
+            in.x = 1.5;
+            in.y = 12;
+            in.inner.name = "inner";
+            in.inner.values = {1, 2, 3};
 
-    if(has("columnNumber"))
-    {
-        err += "columnNumber: " + (std::string)get("columnNumber");
-    }
+            js_quickjs::value obj(vctx);
+            obj = in;
 
-    if(!is_object())
-    {
-        return "Exception: " + (std::string)*this;
-    }
+            assert((std::string)obj["inner"]["name"] == "inner");
 
-    return err;
-}
+            reflect_test out = obj;
 
-js_quickjs::value js_quickjs::get_global(js_quickjs::value_context& vctx)
-{
-    js_quickjs::value val(vctx);
-    JSValue found = JS_GetGlobalObject(vctx.ctx);
+            assert(out.x == 1.5 && out.y == 12);
+            assert(out.inner.name == "inner" && out.inner.values == in.inner.values);
 
-    val = found;
+            std::vector<reflect_test> list = js_quickjs::eval(vctx, "[{x:2, y:3}]");
 
-    JS_FreeValue(vctx.ctx, found);
+            assert(list.size() == 1 && list[0].x == 2 && list[0].y == 3 && list[0].inner.values.size() == 0);
 
-    return val;
-}
+            ///the nested objects must be released on the way out, or the runtime asserts on teardown
+            js_quickjs::value_context throw_ctx(nullptr, nullptr);
 
-void js_quickjs::set_global(js_quickjs::value_context& vctx, const js_quickjs::value& val)
-{
-    ///UNIMPLEMENTED BUT NOT THE END OF THE WORLD
-    //JS_SetGlobal
-}
+            bool rejected = false;
 
-js_quickjs::value js_quickjs::get_current_function(js_quickjs::value_context& vctx)
-{
-    JSValue rval = JS_GetActiveFunction(vctx.ctx);
+            try
+            {
+                reflect_test bad = js_quickjs::eval(throw_ctx, "({x: 1, inner: {name: 'a', values: {length: 1e300}}})");
+            }
+            catch(std::runtime_error&)
+            {
+                rejected = true;
+            }
 
-    js_quickjs::value ret(vctx);
+            assert(rejected);
+        }
 
-    ret = rval;
+        {
+            js_quickjs::value_context class_ctx(nullptr, nullptr);
 
-    return ret;
-}
+            js_quickjs::native_class<native_class_test>::define(class_ctx, "Counter", {{"add", js_quickjs::native_class<native_class_test>::method<&native_class_test::add>}});
 
-js_quickjs::value js_quickjs::get_this(js_quickjs::value_context& vctx)
-{
-    return vctx.get_current_this();
-}
+            bool destroyed = false;
 
-js_quickjs::value js_quickjs::get_heap_stash(js_quickjs::value_context& vctx)
-{
-    heap_stash* stash = (heap_stash*)JS_GetRuntimeOpaque(JS_GetRuntime(vctx.ctx));
+            {
+                auto counter = std::make_shared<native_class_test>();
+                counter->destroyed = &destroyed;
 
-    js_quickjs::value ret(vctx, js_quickjs::undefined);
-    ret = stash->heap_stash_value;
+                js_quickjs::value glob = js_quickjs::get_global(class_ctx);
+                glob["counter"] = counter;
 
-    return ret;
-}
+                int result = js_quickjs::eval(class_ctx, "counter.add(2); counter.add(3)");
 
-js_quickjs::value js_quickjs::get_global_stash(js_quickjs::value_context& vctx)
-{
-    global_stash* stash = (global_stash*)JS_GetContextOpaque(vctx.ctx);
+                assert(result == 5 && counter->total == 5);
 
-    js_quickjs::value ret(vctx);
-    ret = stash->global_stash_value;
+                std::shared_ptr<native_class_test> back = glob["counter"];
 
-    return ret;
-}
+                assert(back == counter);
 
-void* js_quickjs::get_sandbox_data_impl(js_quickjs::value_context& vctx)
-{
-    heap_stash* stash = (heap_stash*)JS_GetRuntimeOpaque(JS_GetRuntime(vctx.ctx));
+                js_quickjs::eval(class_ctx, "counter = undefined");
+            }
 
-    assert(stash->sandbox);
+            class_ctx.compact_heap_stash();
 
-    return (void*)stash->sandbox;
-}
+            assert(destroyed);
+        }
 
-#if 0
-js_quickjs::value js_quickjs::add_getter(js_quickjs::value& base, const std::string& key, js_quickjs::funcptr_t func)
-{
-    js_quickjs::value val(*base.vctx);
-    val = func;
+        {
+            js_quickjs::value glob = js_quickjs::get_global(vctx);
+            glob["fast_add"] = js_quickjs::fast_function<fast_add>;
+            glob["fast_concat"] = js_quickjs::fast_function<fast_concat>;
 
-    JSAtom str = JS_NewAtomLen(base.ctx, key.c_str(), key.size());
+            double sum = js_quickjs::eval(vctx, "fast_add(1, 2.5)");
+            std::string with = js_quickjs::eval(vctx, "fast_concat('a', 4)");
+            std::string without = js_quickjs::eval(vctx, "fast_concat('a')");
 
-    JS_DefineProperty(base.ctx, base.val, str, JS_UNDEFINED, val.val, JS_UNDEFINED, JS_PROP_HAS_GET);
+            assert(sum == 3.5);
+            assert(with == "a4");
+            assert(without == "anone");
+        }
 
-    JS_FreeAtom(base.ctx, str);
+        {
+            js_quickjs::value glob = js_quickjs::get_global(vctx);
 
-    return val;
-}
+            int calls = 0;
 
-js_quickjs::value js_quickjs::add_setter(js_quickjs::value& base, const std::string& key, js_quickjs::funcptr_t func)
-{
-    js_quickjs::value val(*base.vctx);
-    val = func;
+            glob["counted"] = js_quickjs::make_function(vctx, [&calls](int by) {calls += by; return calls;});
 
-    JSAtom str = JS_NewAtomLen(base.ctx, key.c_str(), key.size());
+            std::function<std::string(js_quickjs::value_context*, std::string)> greet = [](js_quickjs::value_context* vctx, std::string name)
+            {
+                return "hi " + name;
+            };
 
-    JS_DefineProperty(base.ctx, base.val, str, JS_UNDEFINED, JS_UNDEFINED, val.val, JS_PROP_HAS_SET);
+            glob["greet"] = js_quickjs::make_function(vctx, greet);
 
-    JS_FreeAtom(base.ctx, str);
+            auto counter = std::make_shared<bound_counter>();
 
-    return val;
-}
-#endif // 0
+            glob["increment"] = js_quickjs::make_function(vctx, counter, &bound_counter::increment);
 
-std::pair<js_quickjs::value, js_quickjs::value> js_quickjs::add_getter_setter(js_quickjs::value& base, const std::string& key, js_quickjs::funcptr_t get, js_quickjs::funcptr_t set)
-{
-    js_quickjs::value vget(*base.vctx);
-    vget = get;
+            int counted = js_quickjs::eval(vctx, "counted(2); counted(3)");
+            std::string greeting = js_quickjs::eval(vctx, "greet('bob')");
+            int incremented = js_quickjs::eval(vctx, "increment(4); increment(1)");
 
-    js_quickjs::value vset(*base.vctx);
-    vset = set;
+            assert(counted == 5 && calls == 5);
+            assert(greeting == "hi bob");
+            assert(incremented == 5 && counter->count == 5);
 
-    JSAtom str = JS_NewAtomLen(base.ctx, key.c_str(), key.size());
+            js_quickjs::eval(vctx, "increment = undefined");
+            vctx.compact_heap_stash();
 
-    if(str == JS_ATOM_NULL)
-        throw std::runtime_error("Null atom in add_getter_setter");
+            assert(counter.use_count() == 1);
 
-    JS_DefinePropertyGetSet(base.ctx, base.val, str, JS_DupValue(base.ctx, vget.val), JS_DupValue(base.ctx, vset.val), 0);
+            js_quickjs::value_context cycle_ctx(nullptr, nullptr);
 
-    JS_FreeAtom(base.ctx, str);
+            std::weak_ptr<int> alive;
 
-    return {vget, vset};
-}
+            {
+                js_quickjs::value owner(cycle_ctx);
 
-#if 0
-JSValue js_quickjs::process_return_value(JSContext* ctx, JSValue in)
-{
-    if(JS_IsException(in))
-    {
-        JSValue except = JS_GetException(ctx);
+                cyclic_capture capture{owner};
+                alive = capture.alive;
 
-        //return JS_GetException(ctx);
-    }
+                owner["fn"] = js_quickjs::make_function(cycle_ctx, std::move(capture));
+            }
+
+            JS_RunGC(cycle_ctx.heap);
 
-    /*JSContext* tctx = nullptr;
+            assert(alive.expired());
+        }
 
-    while(JS_ExecutePendingJob(JS_GetRuntime(ctx), &tctx) > 0)
-    {
+        {
+            js_quickjs::value_context list_ctx(nullptr, nullptr);
 
-    }*/
+            static const JSCFunctionListEntry math_natives[] =
+            {
+                js_quickjs::fast_entry<fast_add>("add"),
+            };
 
-    return JS_DupValue(ctx, in);
-}
-#endif // 0
+            static const JSCFunctionListEntry natives[] =
+            {
+                js_quickjs::entry<empty_func>("empty"),
+                js_quickjs::fast_entry<fast_concat>("concat"),
+                js_quickjs::object_entry("maths", math_natives),
+            };
 
-js_quickjs::value js_quickjs::execute_promises(js_quickjs::value_context& vctx, js_quickjs::value& potential_promise)
-{
-    js_quickjs::value js_val = potential_promise;
+            js_quickjs::set_global_function_list(list_ctx, natives);
 
-    if(js_val.has("then"))
-    {
-        std::string to_eval = R"(
-                    // Values:
-                    //   - undefined: promise not finished
-                    //   - false: error ocurred, __promiseError is set.
-                    //   - true: finished, __promiseSuccess is set.
-                    var __promiseResult = false;
-                    var __promiseValue = undefined;
-
-                    var __resolvePromise = function(p) {
-                        p
-                            .then(value => {
-                                __promiseResult = true;
-                                __promiseValue = value;
-                            }, e => {
-                                __promiseResult = false;
-                                __promiseValue = e;
-                            })
-                    }
+            js_quickjs::new_native_module(list_ctx, "natives", math_natives);
 
-                    __resolvePromise;
-                )";
+            js_quickjs::value importer = js_quickjs::compile_module(list_ctx, "import {add} from 'natives'; globalThis.imported = add(40, 2);", "importer");
 
-        js_quickjs::value prom_function = js_quickjs::eval(vctx, to_eval);
+            js_quickjs::call_compiled(importer);
 
-        js_quickjs::call(prom_function, js_val);
+            assert((int)js_quickjs::eval(list_ctx, "imported") == 42);
 
-        vctx.execute_jobs();
+            int length = js_quickjs::eval(list_ctx, "concat.length");
+            std::string name = js_quickjs::eval(list_ctx, "concat.name");
+            double sum = js_quickjs::eval(list_ctx, "empty(); maths.add(2, 0.5)");
 
-        js_val = js_quickjs::get_global(vctx).get("__promiseValue");
-        bool is_err = (bool)js_quickjs::get_global(vctx).get("__promiseResult") == false;
+            assert(length == 2);
+            assert(name == "concat");
+            assert(sum == 2.5);
+        }
 
-        if(js_val.is_exception() || js_val.is_error() || is_err)
         {
-            js_val = js_quickjs::make_error(vctx, js_val.to_error_message());
-        }
-    }
-    else
-    {
-        vctx.execute_jobs();
-    }
+            js_quickjs::value obj = js_quickjs::eval(vctx, "({scale:3, apply:function(x){return x * this.scale;}})");
 
-    return js_val;
-}
+            js_quickjs::key apply_key(vctx, "apply");
 
-std::pair<bool, js_quickjs::value> js_quickjs::call_compiled(value& bitcode)
-{
-    JSValue ret = JS_EvalFunction(bitcode.ctx, JS_DupValue(bitcode.ctx, bitcode.val));
+            js_quickjs::prepared_call apply(obj, apply_key);
 
-    if(JS_IsException(ret))
-        throw_exception(bitcode.ctx, ret);
+            int first = apply.invoke<int>(2);
+            double second = apply.invoke<double>(1.5);
 
-    bool err = JS_IsError(bitcode.ctx, ret);
+            assert(first == 6 && second == 4.5);
 
-    value rval(*bitcode.vctx);
-    rval = ret;
+            js_quickjs::value add = js_quickjs::eval(vctx, "(function(a, b){return a + b;})");
 
-    JS_FreeValue(bitcode.ctx, ret);
+            js_quickjs::prepared_call add_call(add);
 
-    return {!err, rval};
-}
+            assert(add_call.invoke<std::string>(std::string("a"), 1) == "a1");
+        }
 
-std::pair<bool, js_quickjs::value> js_quickjs::compile(value_context& vctx, const std::string& data)
-{
-    return compile(vctx, data, "unnamed");
-}
+        {
+            js_quickjs::value halve = js_quickjs::eval(vctx, "(function(x){if(x < 0) throw 'negative'; return x / 2;})");
 
-std::pair<bool, js_quickjs::value> js_quickjs::compile(value_context& vctx, const std::string& data, const std::string& name)
-{
-    JSValue ret = JS_Eval(vctx.ctx, data.c_str(), data.size(), name.c_str(), JS_EVAL_FLAG_COMPILE_ONLY | JS_EVAL_FLAG_STRIP);
+            js_quickjs::prepared_call halve_call(halve);
 
-    if(JS_IsException(ret))
-        throw_exception(vctx.ctx, ret);
+            std::vector<int> inputs{2, -1, 5};
+            std::vector<double> outputs(inputs.size());
+            bool ok[3] = {};
 
-    js_quickjs::value val(vctx);
-    val = ret;
+            size_t failures = halve_call.invoke_batch(inputs.data(), inputs.size(), outputs.data(), ok);
 
-    JS_FreeValue(vctx.ctx, ret);
+            assert(failures == 1);
+            assert(ok[0] && !ok[1] && ok[2]);
+            assert(outputs[0] == 1 && outputs[1] == 0 && outputs[2] == 2.5);
 
-    bool err = JS_IsError(vctx.ctx, val.val);
-    return {!err, val};
-}
+            ///a result that can't be converted fails only its own item
+            js_quickjs::value ranges = js_quickjs::eval(vctx, "(function(x){return x < 0 ? {length: 1e300} : [x, x];})");
 
-namespace js_quickjs
-{
+            js_quickjs::prepared_call ranges_call(ranges);
 
-std::string dump_function(value& val)
-{
-    size_t size = 0;
-    uint8_t* out = JS_WriteObject(val.ctx, &size, val.val, JS_WRITE_OBJ_BYTECODE);
+            std::vector<std::vector<int>> range_outputs(inputs.size());
 
-    return std::string(out, out + size);
-}
+            size_t range_failures = ranges_call.invoke_batch(inputs.data(), inputs.size(), range_outputs.data(), ok);
 
-value eval(value_context& vctx, const std::string& data, const std::string& name)
-{
-    JSValue ret = JS_Eval(vctx.ctx, data.c_str(), data.size(), name.c_str(), 0);
+            assert(range_failures == 1);
+            assert(ok[0] && !ok[1] && ok[2]);
+            assert(range_outputs[0] == std::vector<int>({2, 2}) && range_outputs[1].empty() && range_outputs[2] == std::vector<int>({5, 5}));
 
-    if(JS_IsException(ret))
-        throw_exception(vctx.ctx, ret, name);
+            js_quickjs::value_context interrupted(always_interrupt, nullptr);
 
-    value rval(vctx);
-    rval = ret;
+            js_quickjs::value spin = js_quickjs::eval(interrupted, "(function(x){for(;;){}})");
 
-    JS_FreeValue(vctx.ctx, ret);
+            js_quickjs::prepared_call spin_call(spin);
 
-    return rval;
-}
+            bool stopped = false;
 
-value eval_module(value_context& vctx, const std::string& data, const std::string& name)
-{
-    JSValue ret = JS_Eval(vctx.ctx, data.c_str(), data.size(), name.c_str(), JS_EVAL_TYPE_MODULE);
+            try
+            {
+                spin_call.invoke_batch(inputs.data(), inputs.size(), outputs.data(), ok);
+            }
+            catch(std::runtime_error&)
+            {
+                stopped = true;
+            }
 
-    if(JS_IsException(ret))
-        throw_exception(vctx.ctx, ret, name);
+            assert(stopped);
+        }
 
-    value rval(vctx);
-    rval = ret;
+        {
+            js_quickjs::value resolved = js_quickjs::eval(vctx, "Promise.resolve(42)");
+            js_quickjs::value rejected = js_quickjs::eval(vctx, "Promise.reject(new Error('nope'))");
 
-    JS_FreeValue(vctx.ctx, ret);
+            js_quickjs::promise_watcher first(vctx, resolved);
+            js_quickjs::promise_watcher second(vctx, rejected);
 
-    return rval;
-}
+            assert(!first.is_settled());
 
-value compile_module(value_context& vctx, const std::string& data, const std::string& name)
-{
-    JSValue ret = JS_Eval(vctx.ctx, data.c_str(), data.size(), name.c_str(), JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+            vctx.execute_jobs();
 
-    if(JS_IsException(ret))
-        throw_exception(vctx.ctx, ret, name);
+            assert(first.is_settled() && !first.is_rejected());
+            assert((int)first.get_result() == 42);
+            assert(second.is_settled() && second.is_rejected());
 
-    value rval(vctx);
-    rval = ret;
+            js_quickjs::value result = js_quickjs::execute_promises(vctx, resolved);
 
-    JS_FreeValue(vctx.ctx, ret);
+            assert((int)result == 42);
+            assert(js_quickjs::execute_promises(vctx, rejected).is_error());
+            assert(!js_quickjs::get_global(vctx).has("__promiseResult"));
 
-    return rval;
-}
+            js_quickjs::value fickle = js_quickjs::eval(vctx, "({then(res, rej){res(1); rej(2); res(3);}})");
 
-value xfer_between_contexts(value_context& destination, const value& val)
-{
-    value next(destination);
-    next = val.val;
+            js_quickjs::promise_watcher third(vctx, fickle);
 
-    return next;
-}
+            assert(third.is_settled() && !third.is_rejected());
+            assert((int)third.get_result() == 1);
 
-value make_proxy(value& target, value& handle)
-{
-    JSValue arr[2] = {target.val, handle.val};
+            js_quickjs::value_context hijack_ctx(nullptr, nullptr);
 
-    JSValue val = js_proxy_constructor(target.ctx, JS_UNDEFINED, 2, arr);
+            js_quickjs::eval(hijack_ctx, "for(const proto of [Object.prototype, Array.prototype]) Object.defineProperty(proto, '1', {set(v){globalThis.stolen = v;}, get(){return 'forged';}});");
 
-    value ret(*target.vctx);
-    ret = val;
+            js_quickjs::value secret = js_quickjs::eval(hijack_ctx, "Promise.resolve('secret')");
 
-    JS_FreeValue(target.ctx, val);
+            js_quickjs::promise_watcher hijacked(hijack_ctx, secret);
 
-    return ret;
-}
+            hijack_ctx.execute_jobs();
 
+            assert((std::string)hijacked.get_result() == "secret");
+            assert(!js_quickjs::get_global(hijack_ctx).has("stolen"));
 
-value from_cbor(value_context& vctx, const std::vector<uint8_t>& cb);
+            ///genuine promises go through the then captured at context creation, not the one script can replace
+            js_quickjs::eval(hijack_ctx, "Promise.prototype.then = function(){globalThis.intercepted = true;};");
 
-void dump_stack(value_context& vctx)
-{
-    printf("Stack tracing unimplemented\n");
-}
-}
+            js_quickjs::value patched = js_quickjs::eval(hijack_ctx, "Promise.resolve(5)");
 
-void empty_func(js_quickjs::value_context* vctx)
-{
+            hijacked.watch(patched);
 
-}
+            hijack_ctx.execute_jobs();
 
-struct quickjs_tester
-{
-    quickjs_tester()
-    {
-        js_quickjs::value_context vctx(nullptr, nullptr);
+            assert(hijacked.is_settled() && (int)hijacked.get_result() == 5);
+            assert(!js_quickjs::get_global(hijack_ctx).has("intercepted"));
 
-        {
-            js_quickjs::value val(vctx);
+            ///a settled watcher rearms the callbacks it already made
+            JSValue first_callback = hijacked.callbacks[0];
 
-            js_quickjs::value dependent(vctx, val, "hello");
-        }
+            js_quickjs::value rewatched = js_quickjs::eval(hijack_ctx, "Promise.reject(6)");
 
-        {
-            js_quickjs::value val(vctx);
-            val = 1234;
+            hijacked.watch(rewatched);
 
-            assert((int)val == 1234);
+            assert(!hijacked.is_settled());
+            assert(JS_VALUE_GET_PTR(hijacked.callbacks[0]) == JS_VALUE_GET_PTR(first_callback));
+
+            hijack_ctx.execute_jobs();
+
+            assert(hijacked.is_rejected() && (int)hijacked.get_result() == 6);
         }
 
         {
-            js_quickjs::value root(vctx);
-            root["dep"] = "hello";
+            js_quickjs::value glob = js_quickjs::get_global(vctx);
+            glob["async_square"] = js_quickjs::async_function<async_square>;
 
-            std::string found = root["dep"];
+            js_quickjs::eval(vctx, "var squared; var square_error; async_square(5).then(v => {squared = v;}); async_square(-1).catch(e => {square_error = e.message;})");
 
-            assert(found == "hello");
+            auto start = std::chrono::steady_clock::now();
+
+            while(!glob.get("squared").is_number() || !glob.get("square_error").is_string())
+            {
+                assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+
+                std::this_thread::yield();
+
+                vctx.execute_jobs();
+            }
+
+            assert((int)glob.get("squared") == 25);
+            assert((std::string)glob.get("square_error") == "negative");
         }
 
         {
-            js_quickjs::value root(vctx);
-            root["hi"] = "hellothere";
-            root["yep"] = "test";
-            root["cat"] = 1234;
+            js_quickjs::value_context convert_ctx(nullptr, nullptr);
 
-            js_quickjs::value subobj(vctx);
-            subobj["further_sub"] = "nope";
+            auto [broken, broken_token] = js_quickjs::make_async_promise(convert_ctx);
+            auto [fine, fine_token] = js_quickjs::make_async_promise(convert_ctx);
 
-            root["super_sub"] = subobj;
+            js_quickjs::value glob = js_quickjs::get_global(convert_ctx);
+            glob["broken"] = broken;
+            glob["fine"] = fine;
 
-            std::string found_1 = root["hi"];
-            std::string found_2 = root["yep"];
-            std::string found_3 = root["testsub"];
+            js_quickjs::eval(convert_ctx, "var broken_error; var fine_value; broken.catch(e => {broken_error = e.message;}); fine.then(v => {fine_value = v;})");
 
-            assert(found_1 == "hellothere");
-            assert(found_2 == "test");
+            js_quickjs::completion* c = new js_quickjs::completion;
+            c->id = broken_token.id;
+            c->make_value = [](JSContext*) -> JSValue {throw std::runtime_error("unconvertible");};
+
+            broken_token.queue->push(c);
+            fine_token.resolve(7);
+
+            convert_ctx.execute_jobs();
+
+            assert((std::string)glob.get("broken_error") == "unconvertible");
+            assert((int)glob.get("fine_value") == 7);
         }
 
         {
-            js_quickjs::value root(vctx);
+            js_quickjs::value_context loop_ctx(nullptr, nullptr);
 
-            root.add_hidden("hello", 1234);
+            js_quickjs::event_loop loop(loop_ctx);
 
-            assert(root.has_hidden("hello"));
-            assert(!root.has_hidden("hello2"));
+            js_quickjs::eval(loop_ctx, R"(
+                var order = [];
+                var ticks = 0;
+                setTimeout(() => order.push("late"), 20);
+                setTimeout((x) => order.push(x), 0, "early");
+                var cancelled = setTimeout(() => order.push("cancelled"), 5);
+                clearTimeout(cancelled);
+                var interval = setInterval(() => {if(++ticks == 3) clearInterval(interval);}, 1);
+            )");
 
-            int val = root.get_hidden("hello");
+            assert(loop.next_timeout().has_value());
 
-            assert(val == 1234);
-        }
+            auto start = std::chrono::steady_clock::now();
 
-        {
-            js_quickjs::value root(vctx);
+            loop.run_until_idle();
 
-            root.add_hidden("hello", "yep");
-            root.add_hidden("hello2", "hurro");
+            assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
 
-            std::string str = root.get_hidden("hello");
+            std::vector<std::string> order = js_quickjs::get_global(loop_ctx).get("order");
 
-            assert(str == "yep");
+            assert(order == std::vector<std::string>({"early", "late"}));
+            assert((int)js_quickjs::get_global(loop_ctx).get("ticks") == 3);
+            assert(!loop.next_timeout().has_value());
+
+            js_quickjs::eval(loop_ctx, "setInterval(() => {}, 5)");
+
+            assert(loop.run_for(std::chrono::milliseconds(15)));
         }
 
         {
-            js_quickjs::value root(vctx);
-            root = js_quickjs::function<empty_func>;
+            js_quickjs::value_context loop_ctx(nullptr, nullptr);
 
-            root.add_hidden("checky", "yes.hello");
+            js_quickjs::event_loop loop(loop_ctx);
 
-            std::string val = root.get_hidden("checky");
+            js_quickjs::eval(loop_ctx, R"(
+                var fired = [];
+                setTimeout(() => fired.push("huge"), 1e300);
+                setTimeout(() => fired.push("nan"), NaN);
+                var huge_interval = setInterval(() => {fired.push("interval"); clearInterval(huge_interval);}, 1e300);
+            )");
 
-            assert(val == "yes.hello");
-        }
+            auto start = std::chrono::steady_clock::now();
 
-        {
-            js_quickjs::value root(vctx);
+            loop.run_until_idle();
 
-            auto val = root.add("hello", js_quickjs::function<empty_func>);
-            val.add_hidden("testy", "hellothere");
-        }
+            assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+            assert((int)js_quickjs::get_global(loop_ctx).get("fired").get("length") == 3);
 
-        {
-            js_quickjs::value func(vctx);
-            func = js_quickjs::function<empty_func>;
+            #ifdef __linux__
+            {
+                auto [promise, token] = js_quickjs::make_async_promise(loop_ctx);
 
-            auto [success, res] = js_quickjs::call(func);
+                token.resolve(1);
 
-            assert(success);
-        }
+                pollfd pfd = {};
+                pfd.fd = loop.fd();
+                pfd.events = POLLIN;
 
-        {
-            auto [success, res] = js_quickjs::compile(vctx, "1+1", "none");
+                ///a host multiplexing on fd() only calls run_once, which has to consume the wake
+                assert(poll(&pfd, 1, 0) == 1);
 
-            assert(success);
+                loop.run_once();
 
-            ///not sure this will work for compiled scripts
-            JSValue ret = JS_EvalFunction(vctx.ctx, JS_DupValue(vctx.ctx, res.val));
+                assert(poll(&pfd, 1, 0) == 0);
+            }
+            #endif
 
-            bool err = JS_IsError(vctx.ctx, ret) || JS_IsException(ret);
+            ///a pooled tenant's timers die with its context, and the next tenant still has the timer functions
+            js_quickjs::eval(loop_ctx, "var stale = 0; setTimeout(() => {stale++;}, 60000);");
 
-            JS_FreeValue(vctx.ctx, ret);
+            assert(loop.next_timeout().has_value());
 
-            assert(!err);
+            loop_ctx.reset();
+
+            assert(!loop.next_timeout().has_value());
+
+            js_quickjs::eval(loop_ctx, "var fresh = 0; setTimeout(() => {fresh++;}, 0);");
+
+            loop.run_until_idle();
+
+            assert((int)js_quickjs::get_global(loop_ctx).get("fresh") == 1);
         }
 
         {
-            js_quickjs::value root(vctx);
+            js_quickjs::value_context interrupted(always_interrupt, nullptr);
 
-            root.add("Hello", "1234");
+            js_quickjs::event_loop loop(interrupted);
 
-            assert(root.has("Hello"));
+            js_quickjs::eval(interrupted, "setTimeout(() => {for(;;){}}, 0)");
 
-            std::string val = root.get("Hello");
+            bool stopped = false;
 
-            assert(val == "1234");
+            try
+            {
+                loop.run_once();
+            }
+            catch(std::runtime_error&)
+            {
+                stopped = true;
+            }
+
+            assert(stopped);
         }
 
         {
-            js_quickjs::value root(vctx);
+            js_quickjs::value_context job_ctx(nullptr, nullptr);
 
-            std::vector<std::string> val{"hi", "hello"};
+            js_quickjs::eval(job_ctx, "var steps = 0; var chain = Promise.resolve(); for(var i=0; i < 100; i++) chain = chain.then(() => {steps++;});");
 
-            root = val;
+            int drains = 0;
 
-            std::vector<std::string> rval = root;
+            while(job_ctx.execute_jobs(10))
+            {
+                drains++;
 
-            assert(rval.size() == 2);
+                assert(drains < 100);
+            }
 
-            assert(rval[0] == "hi");
-            assert(rval[1] == "hello");
+            js_quickjs::job_stats stats = job_ctx.get_job_stats();
+
+            assert((int)js_quickjs::get_global(job_ctx).get("steps") == 100);
+            assert(drains >= 9);
+            assert(stats.jobs >= 100);
+            assert(stats.last_drain_jobs <= 10);
+            assert(stats.cut_short == (uint64_t)drains);
+
+            assert(stats.timed_drains == 0);
+            assert(stats.total_time.count() == 0);
+
+            assert(!job_ctx.execute_jobs(10, std::chrono::steady_clock::now() + std::chrono::seconds(1)));
+            assert(job_ctx.get_job_stats().timed_drains == 1);
         }
 
+        #ifdef __cpp_impl_coroutine
         {
-            int some_ptr = 0;
+            js_quickjs::value deferred = js_quickjs::eval(vctx, "var resolve_later; new Promise(r => {resolve_later = r;})");
 
-            js_quickjs::value root(vctx);
-            root.set_ptr(&some_ptr);
+            int result = 0;
 
-            int* fptr = root.get_ptr<int>();
+            await_test(vctx, deferred, result);
 
-            assert(&some_ptr == fptr);
+            vctx.execute_jobs();
 
-            assert(fptr);
+            assert(result == 0);
 
-            assert(*fptr == some_ptr);
-        }
+            js_quickjs::eval(vctx, "resolve_later(7)");
 
-        {
-            js_quickjs::value root(vctx);
+            vctx.execute_jobs();
 
-            root["hi"] = "hello";
+            assert(result == 7);
 
-            std::string json = root.to_json();
+            ///a throwing resume must not lose the waiters queued behind it
+            js_quickjs::value shared = js_quickjs::eval(vctx, "var resolve_shared; new Promise(r => {resolve_shared = r;})");
 
-            assert(json.size() > 0);
-        }
+            throwing_coroutine thrower = await_then_throw(vctx, shared);
+            await_test(vctx, shared, result);
 
-        {
-            js_quickjs::value glob = js_quickjs::get_global(vctx);
+            js_quickjs::eval(vctx, "resolve_shared(3)");
 
-            glob["hi"] = "hello";
+            bool threw = false;
 
-            assert(glob.has("hi") && ((std::string)glob["hi"]) == "hello");
+            try
+            {
+                vctx.execute_jobs();
+            }
+            catch(std::runtime_error&)
+            {
+                threw = true;
+            }
 
-            assert(glob.has("globalThis"));
+            thrower.handle.destroy();
+
+            assert(threw && result == 7);
+
+            vctx.execute_jobs();
+
+            assert(result == 3);
         }
+        #endif // __cpp_impl_coroutine
     }
 };
 
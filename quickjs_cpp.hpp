@@ -3,9 +3,28 @@
 
 #include <variant>
 #include <vector>
+#include <array>
 #include <map>
+#include <list>
 #include <optional>
+#include <string_view>
 #include <tuple>
+#include <memory>
+#include <functional>
+#if __has_include(<span>)
+#include <span>
+#endif
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <type_traits>
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+#endif
 #include <assert.h>
 #include <nlohmann/json.hpp>
 #include <quickjs/quickjs.h>
@@ -14,8 +33,66 @@ namespace js_quickjs
 {
     void throw_exception(JSContext* ctx, JSValue val, const std::string& data = "");
 
+    ///nesting limit for conversions between JS values and nlohmann::json
+    constexpr int max_json_depth = 256;
+    ///element limit for conversions from JS arrays to C++ containers. length is script controlled
+    ///and C++ allocations don't count towards the runtime's memory limit
+    constexpr uint32_t max_array_length = 1 << 24;
+    ///containers reserve at most this many elements up front, and grow as elements are actually read
+    constexpr uint32_t max_array_reserve = 4096;
+
+    ///owns a JSValue for the length of a scope, so conversions that recurse into throwing code don't leak it
+    struct jsvalue_guard
+    {
+        JSContext* ctx = nullptr;
+        JSValue val = JS_UNDEFINED;
+
+        jsvalue_guard(JSContext* _ctx, JSValue _val) : ctx(_ctx), val(_val){}
+        jsvalue_guard(const jsvalue_guard&) = delete;
+        jsvalue_guard& operator=(const jsvalue_guard&) = delete;
+
+        ~jsvalue_guard()
+        {
+            JS_FreeValue(ctx, val);
+        }
+
+        ///hands ownership back to the caller
+        JSValue release()
+        {
+            JSValue ret = val;
+            val = JS_UNDEFINED;
+            return ret;
+        }
+    };
+
     struct value;
 
+    struct heap_compact_stats
+    {
+        uint64_t slices = 0;
+        uint64_t passes = 0;
+        uint64_t entries_scanned = 0;
+        uint64_t entries_freed = 0;
+        size_t last_slice_scanned = 0;
+        size_t last_slice_freed = 0;
+        size_t entries = 0;
+    };
+
+    ///counters for value_context::execute_jobs, per runtime. Coroutine resumes count as jobs
+    struct job_stats
+    {
+        uint64_t drains = 0;
+        uint64_t jobs = 0;
+        ///drains that returned with work left, eg from running out of budget
+        uint64_t cut_short = 0;
+        size_t last_drain_jobs = 0;
+        ///the times below only cover drains given a deadline, so the unbounded execute_jobs() stays free of clock reads
+        uint64_t timed_drains = 0;
+        std::chrono::nanoseconds last_drain_time{0};
+        std::chrono::nanoseconds total_time{0};
+        std::chrono::nanoseconds max_drain_time{0};
+    };
+
     struct value_context
     {
         std::vector<value> this_stack;
@@ -33,12 +110,92 @@ namespace js_quickjs
         value_context& operator=(const value_context& other);
 
         void push_this(const value& val);
+        void push_this(value&& val);
         void pop_this();
         value get_current_this();
 
         void execute_jobs();
+        ///runs at most max_jobs jobs, stopping early once deadline passes (checked between jobs, so one long
+        ///job can overrun it). Returns true if work remains for a later call
+        bool execute_jobs(size_t max_jobs, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+        job_stats get_job_stats();
         void execute_timeout_check();
+        ///completes a full pass and runs the cycle collector
         void compact_heap_stash();
+        ///scans at most budget heap stash entries, resuming where the last slice stopped. A budget of 0 is treated as 1
+        ///returns true if the current pass has work left
+        bool compact_heap_stash(size_t budget);
+        ///runs a slice of budget entries from the runtime's interrupt hook while script executes
+        ///0 disables it and hands the interrupt hook back to the handler the context was created with
+        void set_auto_compact(size_t budget);
+        heap_compact_stats get_compact_stats();
+
+        ///replaces the tenant's context with a fresh one on the same runtime, dropping its globals, hidden values
+        ///and stash contents, then runs the gc. Values from before the reset must not be used afterwards
+        ///throws if the tenant still has work queued after a bounded drain, or async work in flight
+        ///only valid on a context that owns its runtime
+        void reset();
+        ///true while a coroutine is suspended on a promise in this runtime. The context can't be destroyed or
+        ///reset until those coroutines resume or are destroyed
+        bool has_promise_waiters();
+    };
+
+    ///keeps initialised runtimes around so that handing one out doesn't pay for JS_NewRuntime/JS_NewContext
+    struct value_context_pool
+    {
+        struct stats
+        {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t resets = 0;
+            uint64_t reset_failures = 0;
+            ///failed resets that left a coroutine suspended on the context, see release
+            uint64_t parked = 0;
+            std::chrono::nanoseconds total_reset_time{0};
+            std::chrono::nanoseconds max_reset_time{0};
+        };
+
+        ///returns its context to the pool on destruction. Must not outlive the pool
+        struct lease
+        {
+            value_context_pool* pool = nullptr;
+            std::unique_ptr<value_context> vctx;
+
+            lease(value_context_pool* _pool, std::unique_ptr<value_context> _vctx);
+            lease(lease&& other);
+            lease& operator=(lease&& other);
+            lease(const lease&) = delete;
+            lease& operator=(const lease&) = delete;
+            ~lease();
+
+            value_context& get(){return *vctx;}
+            value_context* operator->(){return vctx.get();}
+            value_context& operator*(){return *vctx;}
+        };
+
+        value_context_pool(int size, JSInterruptHandler handler, void* sandbox);
+        value_context_pool(const value_context_pool&) = delete;
+        value_context_pool& operator=(const value_context_pool&) = delete;
+        ~value_context_pool();
+
+        lease acquire();
+        stats get_stats();
+
+    private:
+        friend struct lease;
+
+        std::unique_ptr<value_context> make_context();
+        void release(std::unique_ptr<value_context> vctx);
+
+        std::mutex mut;
+        std::vector<std::unique_ptr<value_context>> free_list;
+        ///contexts released with coroutines still suspended on them, which are kept alive rather than freed
+        ///out from under those coroutines' frames
+        std::vector<std::unique_ptr<value_context>> parked;
+        int max_size = 0;
+        JSInterruptHandler* handler = nullptr;
+        void* sandbox = nullptr;
+        stats pool_stats;
     };
 
     using funcptr_t = JSValue (*)(JSContext*, JSValueConst, int, JSValueConst*);
@@ -49,6 +206,85 @@ namespace js_quickjs
     struct null_t{};
     const static inline null_t null;
 
+    template<typename T>
+    constexpr const char* typed_array_name()
+    {
+        if constexpr(std::is_same_v<T, int8_t>)
+            return "Int8Array";
+        else if constexpr(std::is_same_v<T, uint8_t>)
+            return "Uint8Array";
+        else if constexpr(std::is_same_v<T, int16_t>)
+            return "Int16Array";
+        else if constexpr(std::is_same_v<T, uint16_t>)
+            return "Uint16Array";
+        else if constexpr(std::is_same_v<T, int32_t>)
+            return "Int32Array";
+        else if constexpr(std::is_same_v<T, uint32_t>)
+            return "Uint32Array";
+        else if constexpr(std::is_same_v<T, int64_t>)
+            return "BigInt64Array";
+        else if constexpr(std::is_same_v<T, uint64_t>)
+            return "BigUint64Array";
+        else if constexpr(std::is_same_v<T, float>)
+            return "Float32Array";
+        else if constexpr(std::is_same_v<T, double>)
+            return "Float64Array";
+        else
+            return nullptr;
+    }
+
+    ///consumes buffer, returns a view of count elements over it
+    JSValue new_typed_array(JSContext* ctx, const char* ctor_name, JSValue buffer, size_t count);
+    ///false if val isn't a typed array of the named kind. On success data points into the JS owned backing store
+    bool get_typed_array_data(JSContext* ctx, JSValueConst val, const char* ctor_name, uint8_t*& data, size_t& bytes);
+    ///val.length, using an atom cached per runtime instead of a string lookup
+    JSValue get_length(JSContext* ctx, JSValueConst val);
+    ///val.length as an element count. Throws unless it's an integer in [0, max_array_length]
+    uint32_t get_element_count(JSContext* ctx, JSValueConst val);
+
+    ///specialise with a tuple of fields to make a struct convertible to and from a JS object, eg
+    ///template<> struct js_quickjs::reflect<vec2> { static constexpr auto fields = std::make_tuple(js_quickjs::field("x", &vec2::x), js_quickjs::field("y", &vec2::y)); };
+    template<typename T>
+    struct reflect;
+
+    template<typename C, typename M>
+    struct field_t
+    {
+        const char* name;
+        M C::* member;
+    };
+
+    template<typename C, typename M>
+    constexpr field_t<C, M> field(const char* name, M C::* member)
+    {
+        return {name, member};
+    }
+
+    template<typename T, typename = void>
+    struct is_reflected : std::false_type{};
+
+    template<typename T>
+    struct is_reflected<T, std::void_t<decltype(reflect<T>::fields)>> : std::true_type{};
+
+    template<typename T>
+    constexpr bool is_reflected_v = is_reflected<T>::value;
+
+    ///atoms for names, created once per runtime and type. type_tag only has to be a unique address per type
+    const JSAtom* get_reflected_atoms(JSContext* ctx, const void* type_tag, const char* const* names, size_t count);
+
+    template<typename T>
+    struct native_class;
+
+    template<typename T>
+    inline
+    const JSAtom* reflected_atoms(JSContext* ctx)
+    {
+        static const auto names = std::apply([](auto&... f){return std::array<const char*, sizeof...(f)>{f.name...};}, reflect<T>::fields);
+        static const char type_tag = 0;
+
+        return get_reflected_atoms(ctx, &type_tag, names.data(), names.size());
+    }
+
     namespace args
     {
         JSValue push(JSContext* ctx, const char* v);
@@ -71,6 +307,14 @@ namespace js_quickjs
         JSValue push(JSContext* ctx, const JSValue& in);
         template<typename T>
         JSValue push(JSContext* ctx, const std::optional<T>& v);
+        #ifdef __cpp_lib_span
+        template<typename T, size_t N>
+        JSValue push(JSContext* ctx, std::span<T, N> v);
+        #endif
+        template<typename T>
+        std::enable_if_t<is_reflected_v<T>, JSValue> push(JSContext* ctx, const T& v);
+        template<typename T>
+        JSValue push(JSContext* ctx, const std::shared_ptr<T>& v);
 
         inline
         JSValue push(JSContext* ctx, const char* v)
@@ -114,10 +358,12 @@ namespace js_quickjs
         {
             JSValue val = JS_NewArray(ctx);
 
-            for(int i=0; i < (int)v.size(); i++)
+            ///defining rather than setting appends straight onto a fresh array's fast element storage,
+            ///skipping the setter lookup down the prototype chain that a [[Set]] does per element
+            for(uint32_t i=0; i < (uint32_t)v.size(); i++)
             {
                 JSValue found = push(ctx, v[i]);
-                JS_SetPropertyUint32(ctx, val, i, found);
+                JS_DefinePropertyValueUint32(ctx, val, i, found, JS_PROP_C_W_E);
             }
 
             return val;
@@ -159,13 +405,7 @@ namespace js_quickjs
             return JS_NULL;
         }
 
-        inline
-        JSValue push(JSContext* ctx, const nlohmann::json& in)
-        {
-            std::string str = in.dump();
-
-            return JS_ParseJSON(ctx, str.c_str(), str.size(), nullptr);
-        }
+        JSValue push(JSContext* ctx, const nlohmann::json& in);
 
         template<typename T>
         inline
@@ -180,6 +420,17 @@ namespace js_quickjs
             return JS_MKPTR(JS_TAG_UNINITIALIZED, in);
         }
 
+        ///see native_class, a null pointer pushes null
+        template<typename T>
+        inline
+        JSValue push(JSContext* ctx, const std::shared_ptr<T>& v)
+        {
+            if(!v)
+                return JS_NULL;
+
+            return native_class<T>::wrap(ctx, v);
+        }
+
         JSValue push(JSContext* ctx, const js_quickjs::value& in);
 
         inline
@@ -208,6 +459,47 @@ namespace js_quickjs
             }
         }
 
+        #ifdef __cpp_lib_span
+        ///copies into a new typed array of the matching element type with a single memcpy
+        template<typename T, size_t N>
+        inline
+        JSValue push(JSContext* ctx, std::span<T, N> v)
+        {
+            constexpr const char* name = typed_array_name<std::remove_const_t<T>>();
+
+            static_assert(name != nullptr, "No typed array for this element type");
+
+            JSValue buf = JS_NewArrayBufferCopy(ctx, (const uint8_t*)v.data(), v.size_bytes());
+
+            if(JS_IsException(buf))
+                return buf;
+
+            return new_typed_array(ctx, name, buf, v.size());
+        }
+        #endif
+
+        ///fields are defined in declaration order, so every object of a type shares one shape
+        template<typename T>
+        inline
+        std::enable_if_t<is_reflected_v<T>, JSValue> push(JSContext* ctx, const T& v)
+        {
+            const JSAtom* atoms = reflected_atoms<T>(ctx);
+
+            jsvalue_guard obj(ctx, JS_NewObject(ctx));
+
+            if(JS_IsException(obj.val))
+                return obj.release();
+
+            std::apply([&](auto&... f)
+            {
+                size_t idx = 0;
+
+                (JS_DefinePropertyValue(ctx, obj.val, atoms[idx++], push(ctx, v.*(f.member)), JS_PROP_C_W_E), ...);
+            }, reflect<T>::fields);
+
+            return obj.release();
+        }
+
         #define UNDEF() if(JS_IsUndefined(val)){out = std::remove_reference_t<decltype(out)>(); return;}
 
         void get(js_quickjs::value_context& vctx, const JSValue& val, std::string& out);
@@ -215,12 +507,22 @@ namespace js_quickjs
         void get(js_quickjs::value_context& vctx, const JSValue& val, int& out);
         void get(js_quickjs::value_context& vctx, const JSValue& val, double& out);
         void get(js_quickjs::value_context& vctx, const JSValue& val, bool& out);
+        template<typename T>
+        std::enable_if_t<std::is_arithmetic_v<T>> get(js_quickjs::value_context& vctx, const JSValue& val, T& out);
         template<typename T, typename U>
         void get(js_quickjs::value_context& vctx, const JSValue& val, std::map<T, U>& out);
         template<typename T>
         void get(js_quickjs::value_context& vctx, const JSValue& val, std::vector<T>& out);
+        #ifdef __cpp_lib_span
+        template<typename T>
+        void get(js_quickjs::value_context& vctx, const JSValue& val, std::span<T>& out);
+        #endif
         template<typename T>
         void get(js_quickjs::value_context& vctx, const JSValue& val, T*& out);
+        template<typename T>
+        std::enable_if_t<is_reflected_v<T>> get(js_quickjs::value_context& vctx, const JSValue& val, T& out);
+        template<typename T>
+        void get(js_quickjs::value_context& vctx, const JSValue& val, std::shared_ptr<T>& out);
         void get(js_quickjs::value_context& vctx, const JSValue& val, js_quickjs::value& out);
         void get(js_quickjs::value_context& vctx, const JSValue& val, std::vector<std::pair<js_quickjs::value, js_quickjs::value>>& out); ///equivalent to std::map
         void get(js_quickjs::value_context& vctx, const JSValue& val, std::vector<js_quickjs::value>& out); ///equivalent to std::map
@@ -279,6 +581,27 @@ namespace js_quickjs
             out = JS_ToBool(vctx.ctx, val) > 0;
         }
 
+        ///the remaining arithmetic types, eg float or uint8_t
+        template<typename T>
+        inline
+        std::enable_if_t<std::is_arithmetic_v<T>> get(js_quickjs::value_context& vctx, const JSValue& val, T& out)
+        {
+            UNDEF();
+
+            if constexpr(std::is_floating_point_v<T>)
+            {
+                double dval = 0;
+                JS_ToFloat64(vctx.ctx, &dval, val);
+                out = (T)dval;
+            }
+            else
+            {
+                int64_t ival = 0;
+                JS_ToInt64(vctx.ctx, &ival, val);
+                out = (T)ival;
+            }
+        }
+
         template<typename T, typename U>
         inline
         void get(js_quickjs::value_context& vctx, const JSValue& val, std::map<T, U>& out)
@@ -322,6 +645,57 @@ namespace js_quickjs
             js_free(vctx.ctx, names);
         }
 
+        constexpr uint32_t numeric_batch_size = 256;
+
+        ///a batch that's entirely int32 or entirely float64 is unpacked straight from the values in a branch free loop
+        ///the compiler can vectorise, mixed batches go through the generic per element conversion
+        template<typename T>
+        inline
+        void convert_numeric_batch(js_quickjs::value_context& vctx, const JSValue* vals, uint32_t count, T* out)
+        {
+            bool all_int = true;
+            bool all_float = true;
+
+            for(uint32_t i=0; i < count; i++)
+            {
+                int tag = JS_VALUE_GET_TAG(vals[i]);
+
+                all_int &= tag == JS_TAG_INT;
+                all_float &= JS_TAG_IS_FLOAT64(tag);
+            }
+
+            if(all_int)
+            {
+                for(uint32_t i=0; i < count; i++)
+                    out[i] = (T)JS_VALUE_GET_INT(vals[i]);
+            }
+            ///out of range doubles must wrap the way JS_ToInt32 does, so only floating point targets take this path
+            else if(all_float && std::is_floating_point_v<T>)
+            {
+                for(uint32_t i=0; i < count; i++)
+                    out[i] = (T)JS_VALUE_GET_FLOAT64(vals[i]);
+            }
+            else
+            {
+                for(uint32_t i=0; i < count; i++)
+                    get(vctx, vals[i], out[i]);
+            }
+        }
+
+        ///frees the values read into a batch so far, whether the batch finishes or a lookup or conversion throws
+        struct numeric_batch_guard
+        {
+            JSContext* ctx = nullptr;
+            JSValue* vals = nullptr;
+            uint32_t held = 0;
+
+            ~numeric_batch_guard()
+            {
+                for(uint32_t i=0; i < held; i++)
+                    JS_FreeValue(ctx, vals[i]);
+            }
+        };
+
         template<typename T>
         inline
         void get(js_quickjs::value_context& vctx, const JSValue& val, std::vector<T>& out)
@@ -330,28 +704,117 @@ namespace js_quickjs
 
             out.clear();
 
-            JSValue jslen = JS_GetPropertyStr(vctx.ctx, val, "length");
+            if constexpr(typed_array_name<T>() != nullptr)
+            {
+                uint8_t* data = nullptr;
+                size_t bytes = 0;
+
+                if(!JS_IsArray(vctx.ctx, val) && get_typed_array_data(vctx.ctx, val, typed_array_name<T>(), data, bytes))
+                {
+                    out.resize(bytes / sizeof(T));
+                    memcpy(out.data(), data, out.size() * sizeof(T));
+                    return;
+                }
+            }
+
+            uint32_t len = get_element_count(vctx.ctx, val);
+
+            if constexpr(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>)
+            {
+                JSValue batch[numeric_batch_size];
+
+                for(uint32_t start=0; start < len; start += numeric_batch_size)
+                {
+                    uint32_t count = std::min<uint32_t>(numeric_batch_size, len - start);
+
+                    numeric_batch_guard guard{vctx.ctx, batch, 0};
+
+                    for(uint32_t i=0; i < count; i++)
+                    {
+                        JSValue found = JS_GetPropertyUint32(vctx.ctx, val, start + i);
 
-            int32_t len = 0;
-            JS_ToInt32(vctx.ctx, &len, jslen);
+                        if(JS_IsException(found))
+                            throw_exception(vctx.ctx, found);
 
-            JS_FreeValue(vctx.ctx, jslen);
+                        batch[guard.held++] = found;
+                    }
 
-            out.reserve(len);
+                    ///grows with the elements actually read rather than trusting length up front
+                    out.resize(start + count);
 
-            for(int i=0; i < len; i++)
+                    convert_numeric_batch(vctx, batch, count, out.data() + start);
+                }
+
+                return;
+            }
+
+            out.reserve(std::min(len, max_array_reserve));
+
+            ///integer indices hit quickjs' fast array path directly, sparse arrays and proxies take the generic lookup
+            for(uint32_t i=0; i < len; i++)
             {
                 JSValue found = JS_GetPropertyUint32(vctx.ctx, val, i);
 
+                if(JS_IsException(found))
+                    throw_exception(vctx.ctx, found);
+
+                jsvalue_guard guard(vctx.ctx, found);
+
                 T next;
                 get(vctx, found, next);
 
                 out.push_back(next);
-
-                JS_FreeValue(vctx.ctx, found);
             }
         }
 
+        template<typename T>
+        inline
+        std::enable_if_t<is_reflected_v<T>> get(js_quickjs::value_context& vctx, const JSValue& val, T& out)
+        {
+            UNDEF();
+
+            const JSAtom* atoms = reflected_atoms<T>(vctx.ctx);
+
+            std::apply([&](auto&... f)
+            {
+                size_t idx = 0;
+
+                auto get_field = [&](auto& member)
+                {
+                    JSValue found = JS_GetProperty(vctx.ctx, val, atoms[idx++]);
+
+                    if(JS_IsException(found))
+                        throw_exception(vctx.ctx, found);
+
+                    jsvalue_guard guard(vctx.ctx, found);
+
+                    get(vctx, found, member);
+                };
+
+                (get_field(out.*(f.member)), ...);
+            }, reflect<T>::fields);
+        }
+
+        #ifdef __cpp_lib_span
+        ///zero copy view of a typed array's backing store. Only valid while the JS value is alive
+        template<typename T>
+        inline
+        void get(js_quickjs::value_context& vctx, const JSValue& val, std::span<T>& out)
+        {
+            constexpr const char* name = typed_array_name<std::remove_const_t<T>>();
+
+            static_assert(name != nullptr, "No typed array for this element type");
+
+            uint8_t* data = nullptr;
+            size_t bytes = 0;
+
+            if(!get_typed_array_data(vctx.ctx, val, name, data, bytes))
+                throw std::runtime_error(std::string("Expected a ") + name);
+
+            out = std::span<T>((T*)data, bytes / sizeof(T));
+        }
+        #endif
+
         template<typename T>
         inline
         void get(js_quickjs::value_context& vctx, const JSValue& val, T*& out)
@@ -361,12 +824,43 @@ namespace js_quickjs
             out = (T*)JS_VALUE_GET_PTR(val);
         }
 
+        ///shares ownership with the JS object, null if val isn't an instance of native_class<T>
+        template<typename T>
+        inline
+        void get(js_quickjs::value_context& vctx, const JSValue& val, std::shared_ptr<T>& out)
+        {
+            UNDEF();
+
+            out = native_class<T>::get_shared(val);
+        }
+
         inline
         void get(js_quickjs::value_context& vctx, const JSValue& val, std::vector<std::pair<js_quickjs::value, js_quickjs::value>>& out);
     }
 
     struct value;
 
+    ///a property name with its atom created up front. Keys are interned per runtime, so constructing
+    ///the same name twice is a lookup rather than an atom hash. Must not outlive the runtime, but atoms belong
+    ///to the runtime rather than the context, so a key stays valid across value_context::reset
+    struct key
+    {
+        JSRuntime* heap = nullptr;
+        ///the context the key was made in, only used to duplicate the atom on runtimes without a heap stash
+        JSContext* ctx = nullptr;
+        JSAtom atom = 0;
+
+        key(value_context& vctx, std::string_view name);
+        key(const key& other);
+        key(key&& other) noexcept;
+        ~key();
+
+        key& operator=(const key& other);
+        key& operator=(key&& other) noexcept;
+    };
+
+    struct value_ref;
+
     struct qstack_manager
     {
         value& val;
@@ -385,10 +879,11 @@ namespace js_quickjs
         bool has_parent = false;
         bool released = false;
 
-        std::variant<std::monostate, int, std::string> indices;
+        std::variant<std::monostate, int, std::string, key> indices;
 
         value(const value& other);
-        //value(value&& other);
+        ///the moved from value is left empty, and no longer tracks a parent
+        value(value&& other) noexcept;
         ///pushes a fresh object
         value(value_context& ctx);
         value(value_context& ctx, const js_quickjs::undefined_t&);
@@ -396,19 +891,23 @@ namespace js_quickjs
         value(value_context& ctx, const value& base, const std::string& key);
         value(value_context& ctx, const value& base, int key);
         value(value_context& ctx, const value& base, const char* key);
+        value(value_context& ctx, const value& base, const js_quickjs::key& key);
         ~value();
 
         bool has(const std::string& key) const;
         bool has(int key) const;
         bool has(const char* key) const;
+        bool has(const js_quickjs::key& key) const;
         bool has_hidden(const std::string& key) const;
 
         value get(const std::string& key);
         value get(int key);
         value get(const char* key);
+        value get(const js_quickjs::key& key);
         value get_hidden(const std::string& key);
 
         bool del(const std::string& key);
+        bool del(const js_quickjs::key& key);
 
         void add_hidden_value(const std::string& key, const value& val);
 
@@ -420,6 +919,14 @@ namespace js_quickjs
             return jval;
         }
 
+        template<typename T>
+        value add(const js_quickjs::key& key, const T& val)
+        {
+            auto jval = js_quickjs::value(*vctx, *this, key);
+            jval = val;
+            return jval;
+        }
+
         template<typename T>
         value add_hidden(const std::string& key, const T& val)
         {
@@ -456,7 +963,8 @@ namespace js_quickjs
         value& operator=(bool v);
         value& operator=(std::nullopt_t v);
         value& operator=(const value& right);
-        //value& operator=(value&& right);
+        ///writes back through the parent like any other assignment, without allocating
+        value& operator=(value&& right) noexcept;
         value& operator=(js_quickjs::undefined_t);
         value& operator=(js_quickjs::null_t);
         value& operator=(const nlohmann::json&);
@@ -471,6 +979,38 @@ namespace js_quickjs
             return *this;
         }
 
+        #ifdef __cpp_lib_span
+        template<typename T, size_t N>
+        value& operator=(std::span<T, N> in)
+        {
+            qstack_manager m(*this);
+
+            val = args::push(ctx, in);
+
+            return *this;
+        }
+        #endif
+
+        template<typename T, typename = std::enable_if_t<is_reflected_v<T>>>
+        value& operator=(const T& in)
+        {
+            qstack_manager m(*this);
+
+            val = args::push(ctx, in);
+
+            return *this;
+        }
+
+        template<typename T>
+        value& operator=(const std::shared_ptr<T>& in)
+        {
+            qstack_manager m(*this);
+
+            val = args::push(ctx, in);
+
+            return *this;
+        }
+
         template<typename T, typename U>
         value& operator=(const std::map<T, U>& in)
         {
@@ -568,6 +1108,29 @@ namespace js_quickjs
             return ret;
         }
 
+        template<typename T, typename = std::enable_if_t<is_reflected_v<T>>>
+        operator T() const
+        {
+            T ret{};
+
+            if(!has_value)
+                return ret;
+
+            args::get(*vctx, val, ret);
+            return ret;
+        }
+
+        template<typename T>
+        operator std::shared_ptr<T>() const
+        {
+            if(!has_value)
+                return nullptr;
+
+            std::shared_ptr<T> ret;
+            args::get(*vctx, val, ret);
+            return ret;
+        }
+
         template<typename T>
         operator T*() const
         {
@@ -581,11 +1144,30 @@ namespace js_quickjs
             return ret;
         }
 
+        #ifdef __cpp_lib_span
+        ///see args::get for std::span, the view dies with the underlying JS value
+        template<typename T>
+        std::span<T> as_span() const
+        {
+            if(!has_value)
+                return std::span<T>();
+
+            std::span<T> ret;
+            args::get(*vctx, val, ret);
+            return ret;
+        }
+        #endif
+
         std::vector<std::pair<js_quickjs::value, js_quickjs::value>> iterate();
 
         value operator[](int64_t val);
         value operator[](const std::string& str);
         value operator[](const char* str);
+        value operator[](const js_quickjs::key& k);
+
+        ///non owning access for transient reads and write back, see value_ref
+        value_ref ref(const js_quickjs::key& k) const;
+        value_ref ref(uint32_t idx) const;
 
         void pack(){}
         void stringify_parse();
@@ -593,18 +1175,68 @@ namespace js_quickjs
         void from_json(const std::string& in);
         std::string to_json();
         std::string to_error_message();
-        nlohmann::json to_nlohmann(int stack_depth = 0);
+        ///throws if the value nests deeper than max_depth levels. Previously the argument was the starting depth
+        nlohmann::json to_nlohmann(int max_depth = max_json_depth);
     };
 
-    inline
-    JSValue val2value(const value& in)
+    ///containers of values rely on this to move rather than copy when they grow
+    static_assert(std::is_nothrow_move_constructible_v<value>);
+    static_assert(std::is_nothrow_move_assignable_v<key>);
+
+    ///a borrowed parent plus a borrowed key, for reading or writing parent[key] without building a value
+    ///nothing is allocated and no refcounts are taken on the parent. The property is fetched lazily
+    ///and held until the ref dies. Refs must not outlive the parent, the key, or (for nested refs) the
+    ///ref they came from, so keep them to a single expression or scope. get() materialises an owning value
+    struct value_ref
     {
-        return in.val;
-    }
+        value_context* vctx = nullptr;
+        JSContext* ctx = nullptr;
+        JSValueConst parent = JS_UNDEFINED;
+        JSAtom atom = 0;
+        uint32_t index = 0;
+        bool is_index = false;
+        mutable JSValue cached = JS_UNINITIALIZED;
+
+        value_ref(value_context& vctx, JSValueConst parent, const js_quickjs::key& k);
+        value_ref(value_context& vctx, JSValueConst parent, uint32_t idx);
+        value_ref(const value_ref&) = delete;
+        value_ref& operator=(const value_ref&) = delete;
+        ~value_ref();
+
+        ///borrowed, valid until the ref is written to or destroyed
+        JSValueConst fetch() const;
+        bool exists() const;
+        value get() const;
+
+        value_ref operator[](const js_quickjs::key& k) const;
+        value_ref operator[](uint32_t idx) const;
 
-    //JSValue process_return_value(JSContext* ctx, JSValue in);
+        template<typename T>
+        value_ref& operator=(const T& in)
+        {
+            set(args::push(ctx, in));
+            return *this;
+        }
 
-    ///This eats C++ exceptions and converts them into JS exceptions
+        ///takes ownership of in
+        void set(JSValue in);
+
+        operator std::string() const;
+        operator int64_t() const;
+        operator int() const;
+        operator double() const;
+        operator bool() const;
+    };
+
+    inline
+    JSValue val2value(const value& in)
+    {
+        return in.val;
+    }
+
+    //JSValue process_return_value(JSContext* ctx, JSValue in);
+
+    ///This eats C++ exceptions and converts them into JS exceptions
     template<typename... T>
     inline
     std::pair<bool, value> call(value& func, T&&... vals)
@@ -635,7 +1267,7 @@ namespace js_quickjs
 
         JS_FreeValue(func.ctx, ret);
 
-        return {!err, rval};
+        return {!err, std::move(rval)};
     }
 
     std::pair<bool, value> call_compiled(value& bitcode);
@@ -649,8 +1281,363 @@ namespace js_quickjs
         return call(func, std::forward<T>(vals)...);
     }
 
+    ///resolves a function and its this once for repeated calls. invoke converts arguments straight to
+    ///JSValues in a stack buffer and the result straight to R, so no property lookups or values are made per call
+    ///JS exceptions are thrown as with call, and a prepared_call must not outlive its context
+    struct prepared_call
+    {
+        value_context* vctx = nullptr;
+        JSContext* ctx = nullptr;
+        JSValue func = JS_UNDEFINED;
+        JSValue this_val = JS_UNDEFINED;
+
+        ///this is the global object, as with call
+        prepared_call(value& func);
+        prepared_call(value& func, const value& this_val);
+        ///obj[k], called with obj as this
+        prepared_call(value& obj, const js_quickjs::key& k);
+        prepared_call(const prepared_call&) = delete;
+        prepared_call& operator=(const prepared_call&) = delete;
+        prepared_call(prepared_call&& other);
+        prepared_call& operator=(prepared_call&& other);
+        ~prepared_call();
+
+        template<typename R = value, typename... T>
+        R invoke(const T&... vals)
+        {
+            std::array<JSValue, sizeof...(T)> argv = {args::push(ctx, vals)...};
+
+            JSValue ret = JS_Call(ctx, func, this_val, (int)argv.size(), argv.data());
+
+            for(JSValue& v : argv)
+                JS_FreeValue(ctx, v);
+
+            if(JS_IsException(ret))
+                throw_exception(ctx, ret);
+
+            if constexpr(std::is_same_v<R, void>)
+            {
+                JS_FreeValue(ctx, ret);
+            }
+            else if constexpr(std::is_same_v<R, value>)
+            {
+                value out(*vctx);
+                out = ret;
+
+                JS_FreeValue(ctx, ret);
+
+                return out;
+            }
+            else
+            {
+                jsvalue_guard guard(ctx, ret);
+
+                R out{};
+                args::get(*vctx, ret, out);
+
+                return out;
+            }
+        }
+
+        ///calls the function once per input, writing each converted result to out and whether it succeeded to ok
+        ///a throw, a returned Error or a result that can't be converted to R marks that item as failed with out
+        ///cleared, and the batch carries on
+        ///uncatchable errors such as an interrupt stop the batch and are rethrown as std::runtime_error
+        ///out and ok must hold count items. Returns the number of failures
+        template<typename R, typename T>
+        size_t invoke_batch(const T* inputs, size_t count, R* out, bool* ok)
+        {
+            size_t failures = 0;
+
+            auto clear = [&](R& item)
+            {
+                if constexpr(std::is_same_v<R, value>)
+                    item = js_quickjs::undefined;
+                else
+                    item = R();
+            };
+
+            for(size_t i=0; i < count; i++)
+            {
+                JSValue arg = args::push(ctx, inputs[i]);
+
+                JSValue ret = JS_Call(ctx, func, this_val, 1, &arg);
+
+                JS_FreeValue(ctx, arg);
+
+                if(JS_IsException(ret))
+                {
+                    JSValue err = JS_GetException(ctx);
+
+                    ///an interrupt has to stop the whole batch, not just fail this item
+                    if(JS_IsUncatchableError(ctx, err))
+                    {
+                        JS_Throw(ctx, err);
+                        throw_exception(ctx, JS_EXCEPTION);
+                    }
+
+                    JS_FreeValue(ctx, err);
+
+                    clear(out[i]);
+                    ok[i] = false;
+                    failures++;
+                    continue;
+                }
+
+                jsvalue_guard guard(ctx, ret);
+
+                ok[i] = !JS_IsError(ctx, ret);
+
+                if(ok[i])
+                {
+                    if constexpr(std::is_same_v<R, value>)
+                    {
+                        out[i] = ret;
+                    }
+                    else
+                    {
+                        try
+                        {
+                            args::get(*vctx, ret, out[i]);
+                        }
+                        catch(std::exception&)
+                        {
+                            ok[i] = false;
+                        }
+                    }
+                }
+
+                if(!ok[i])
+                {
+                    clear(out[i]);
+                    failures++;
+                }
+            }
+
+            return failures;
+        }
+
+        #ifdef __cpp_lib_span
+        template<typename R, typename T>
+        size_t invoke_batch(std::span<const T> inputs, std::span<R> out, std::span<bool> ok)
+        {
+            if(out.size() < inputs.size() || ok.size() < inputs.size())
+                throw std::runtime_error("invoke_batch output storage smaller than its inputs");
+
+            return invoke_batch(inputs.data(), inputs.size(), out.data(), ok.data());
+        }
+        #endif
+
+    private:
+        void init(value& _func, JSValue _this);
+    };
+
+    ///records how a promise or thenable settles, through native then callbacks rather than script or globals
+    ///genuine promises are attached to with the context's original Promise.prototype.then, thenables with their own
+    ///the outcome only changes while jobs run, eg from value_context::execute_jobs. watch can be called
+    ///again to reuse the watcher for another promise
+    ///like a value, a watcher must be destroyed before its value_context is destroyed or reset. That includes
+    ///watchers inside suspended coroutine frames, so destroy those coroutines first
+    struct promise_watcher
+    {
+        value_context* vctx = nullptr;
+        JSContext* ctx = nullptr;
+        ///null prototype object. Index 0 holds the settle state, 1 the fulfilment value or rejection reason,
+        ///2 a waiting coroutine's id
+        JSValue state = JS_UNDEFINED;
+        ///the fulfil and reject callbacks bound to state
+        JSValue callbacks[2] = {JS_UNDEFINED, JS_UNDEFINED};
+        ///set while watching a genuine promise. Its reactions run at most once, so after it settles the next
+        ///watch can reuse state and callbacks instead of allocating new ones
+        bool rearmable = false;
+
+        promise_watcher(value_context& vctx);
+        promise_watcher(value_context& vctx, value& promise);
+        promise_watcher(const promise_watcher&) = delete;
+        promise_watcher& operator=(const promise_watcher&) = delete;
+        ~promise_watcher();
+
+        void watch(value& promise);
+
+        bool is_settled();
+        bool is_rejected();
+        ///undefined until settled
+        value get_result();
+
+    private:
+        int get_state();
+        void cancel_wait();
+        void free_callbacks();
+    };
+
+    ///handle_address is resumed from value_context::execute_jobs once the watched promise settles
+    ///the coroutine must stay alive while it waits, destroying the watcher cancels the wait
+    void add_promise_waiter(promise_watcher& watcher, void* handle_address);
+
+    #ifdef __cpp_impl_coroutine
+    struct promise_awaiter
+    {
+        promise_watcher watcher;
+
+        promise_awaiter(value_context& vctx, value& promise) : watcher(vctx, promise){}
+
+        bool await_ready()
+        {
+            return watcher.is_settled();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            add_promise_waiter(watcher, handle.address());
+        }
+
+        ///the fulfilment value, or an error value as with execute_promises
+        value await_resume();
+    };
+
+    ///co_await js_quickjs::await(vctx, promise) suspends the calling coroutine until promise settles
+    ///something must keep calling vctx.execute_jobs() to make progress, and non thenables complete immediately
+    inline
+    promise_awaiter await(value_context& vctx, value& promise)
+    {
+        return promise_awaiter(vctx, promise);
+    }
+    #endif // __cpp_impl_coroutine
+
     js_quickjs::value execute_promises(js_quickjs::value_context& vctx, js_quickjs::value& potential_promise);
 
+    ///an async result waiting to be delivered on the JS thread
+    struct completion
+    {
+        int64_t id = 0;
+        bool success = true;
+        ///called on the JS thread, returns the fulfilment value
+        std::function<JSValue(JSContext*)> make_value;
+        std::string error;
+        completion* next = nullptr;
+    };
+
+    struct event_waker;
+
+    ///lock free multi producer single consumer stack. Any thread may push, the owning runtime's thread takes
+    ///everything at once from value_context::execute_jobs
+    struct completion_queue
+    {
+        std::atomic<completion*> head{nullptr};
+        ///woken after each push from the pushing thread. Created by the runtime's first event loop and owned by
+        ///the queue, so a push racing a loop's destruction never touches a freed waker
+        std::atomic<event_waker*> waker{nullptr};
+
+        void push(completion* c);
+        ///in completion order
+        std::vector<completion*> take_all();
+
+        ~completion_queue();
+    };
+
+    ///completes one async promise from any thread. Only the first resolve or reject has an effect, and a
+    ///token can safely outlive its runtime, in which case completing it does nothing
+    struct completion_token
+    {
+        std::shared_ptr<completion_queue> queue;
+        int64_t id = 0;
+
+        template<typename T>
+        void resolve(T result)
+        {
+            completion* c = new completion;
+            c->id = id;
+            c->make_value = [result = std::move(result)](JSContext* ctx){return args::push(ctx, result);};
+
+            queue->push(c);
+        }
+
+        void resolve();
+        void reject(const std::string& error);
+    };
+
+    ///a promise in vctx and the token that settles it, must be called on vctx's thread
+    std::pair<value, completion_token> make_async_promise(value_context& vctx);
+
+    struct thread_pool
+    {
+        thread_pool(int threads);
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+        ///finishes every queued task first
+        ~thread_pool();
+
+        void submit(std::function<void()> task);
+
+    private:
+        std::mutex mut;
+        std::condition_variable cv;
+        std::deque<std::function<void()>> tasks;
+        std::vector<std::thread> workers;
+        bool stopping = false;
+    };
+
+    ///shared by async_function, sized to the hardware
+    thread_pool& get_async_pool();
+
+    ///drives one runtime: timers, the job queue and async completions. Constructing it installs
+    ///setTimeout, setInterval, clearTimeout and clearInterval into vctx's global object, and value_context::reset puts them
+    ///back into the fresh context after dropping the old tenant's timers
+    ///at most one loop per runtime, and it should exist before async work is started
+    ///for multiplexing many loops on one thread, wait on each fd() with a timeout of next_timeout() and call
+    ///run_once on the ones that wake
+    struct event_loop
+    {
+        using clock = std::chrono::steady_clock;
+
+        event_loop(value_context& vctx);
+        event_loop(const event_loop&) = delete;
+        event_loop& operator=(const event_loop&) = delete;
+        ~event_loop();
+
+        ///readable when an async completion arrives. -1 where eventfd isn't available, use wait instead
+        int fd();
+        ///time until the earliest timer is due, nullopt if there are none
+        std::optional<std::chrono::milliseconds> next_timeout();
+
+        ///runs due timers and jobs without blocking, returns true while there's still work outstanding
+        bool run_once();
+        ///blocks until a timer is due, a completion arrives or timeout passes (nullopt is forever)
+        void wait(std::optional<std::chrono::milliseconds> timeout);
+        void run_until_idle();
+        ///returns true if work remains when duration runs out
+        bool run_for(std::chrono::milliseconds duration);
+
+        ///delays are clamped like browsers do: negative is 0, and anything past 2^31-1 is 1
+        int64_t add_timer(JSValue func, std::vector<JSValue> args, int64_t delay_ms, bool repeat);
+        void remove_timer(int64_t id);
+
+        ///value_context::reset drops the old tenant's timers, then reinstalls the timer functions into the new context
+        void clear_timers();
+        void install_timers();
+
+    private:
+        struct timer
+        {
+            JSValue func = JS_UNDEFINED;
+            std::vector<JSValue> args;
+            int64_t interval_ms = 0;
+            bool repeat = false;
+            clock::time_point due;
+        };
+
+        void free_timer(timer& t);
+        bool has_work();
+
+        value_context& vctx;
+        ///owned by the runtime's completion queue
+        event_waker* waker = nullptr;
+        std::map<int64_t, timer> timers;
+        ///min heap of due time and id, stale entries for removed or rescheduled timers are skipped
+        std::vector<std::pair<clock::time_point, int64_t>> timer_heap;
+        int64_t next_timer_id = 0;
+    };
+
     template<typename T, typename Enable = void>
     struct is_optional : std::false_type {};
 
@@ -663,10 +1650,19 @@ namespace js_quickjs
         return std::is_same_v<T, js_quickjs::value_context*>;
     }
 
+    template<typename... U>
+    constexpr bool starts_with_context()
+    {
+        if constexpr(sizeof...(U) == 0)
+            return false;
+        else
+            return is_first_context<U...>();
+    }
+
     template<typename T, typename... U>
     constexpr int num_args(T(*fptr)(U...))
     {
-        if constexpr(is_first_context<U...>())
+        if constexpr(starts_with_context<U...>())
             return sizeof...(U) - 1;
         else
             return sizeof...(U);
@@ -738,13 +1734,14 @@ namespace js_quickjs
         }
     };
 
-    template<typename T, typename... U>
+    ///func is anything callable as T(U...)
+    template<typename T, typename... U, typename F>
     inline
-    JSValue js_safe_function_decomposed(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst *argv, T(*func)(U...))
+    JSValue js_safe_call_decomposed(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst *argv, F& func)
     {
         ///semantics here are wrong
         ///need to pad arguments up to this size with undefined
-        if(argc > js_quickjs::num_args(func))
+        if(argc > (int)sizeof...(U) - 1)
         {
             return JS_ThrowInternalError(ctx, "Bad quickjs function, too many args");
         }
@@ -758,7 +1755,7 @@ namespace js_quickjs
         js_quickjs::value func_this(vctx);
         func_this = this_val;
 
-        vctx.push_this(func_this);
+        vctx.push_this(std::move(func_this));
         this_cleaner clean(vctx);
 
         std::index_sequence_for<U...> iseq;
@@ -810,6 +1807,13 @@ namespace js_quickjs
         }
     }
 
+    template<typename T, typename... U>
+    inline
+    JSValue js_safe_function_decomposed(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst *argv, T(*func)(U...))
+    {
+        return js_safe_call_decomposed<T, U...>(ctx, this_val, argc, argv, func);
+    }
+
     template<auto func>
     inline
     JSValue function(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv)
@@ -817,8 +1821,517 @@ namespace js_quickjs
         return js_safe_function_decomposed(ctx, this_val, argc, argv, func);
     }
 
+    ///converts straight from a borrowed JSValue for the common parameter types, following the same rules
+    ///as args::get (eg undefined becomes T()). Other types go through args::get
+    template<typename T>
+    inline
+    T from_js(JSContext* ctx, JSValueConst val)
+    {
+        static_assert(!std::is_same_v<T, js_quickjs::value> && !std::is_same_v<T, js_quickjs::value_context*>,
+                      "fast_function can't take values, use js_quickjs::function");
+
+        if constexpr(is_optional<T>::value)
+        {
+            if(JS_IsUndefined(val))
+                return std::nullopt;
+
+            return from_js<typename T::value_type>(ctx, val);
+        }
+        else
+        {
+            if(JS_IsUndefined(val))
+                return T();
+
+            if constexpr(std::is_same_v<T, bool>)
+            {
+                return JS_ToBool(ctx, val) > 0;
+            }
+            else if constexpr(std::is_integral_v<T>)
+            {
+                if(JS_VALUE_GET_TAG(val) == JS_TAG_INT)
+                    return (T)JS_VALUE_GET_INT(val);
+
+                int64_t out = 0;
+                JS_ToInt64(ctx, &out, val);
+                return (T)out;
+            }
+            else if constexpr(std::is_floating_point_v<T>)
+            {
+                int tag = JS_VALUE_GET_TAG(val);
+
+                if(tag == JS_TAG_INT)
+                    return (T)JS_VALUE_GET_INT(val);
+
+                if(JS_TAG_IS_FLOAT64(tag))
+                    return (T)JS_VALUE_GET_FLOAT64(val);
+
+                double out = 0;
+                JS_ToFloat64(ctx, &out, val);
+                return (T)out;
+            }
+            else if constexpr(std::is_same_v<T, std::string>)
+            {
+                size_t len = 0;
+                const char* str = JS_ToCStringLen(ctx, &len, val);
+
+                if(str == nullptr)
+                    return std::string();
+
+                std::string out(str, len);
+
+                JS_FreeCString(ctx, str);
+
+                return out;
+            }
+            else
+            {
+                value_context vctx(ctx);
+
+                T out;
+                args::get(vctx, val, out);
+                return out;
+            }
+        }
+    }
+
+    ///func is anything callable as R(U...)
+    template<typename R, typename... U, typename F, std::size_t... Is>
+    inline
+    JSValue fast_call(JSContext* ctx, int argc, JSValueConst* argv, F& func, std::index_sequence<Is...>)
+    {
+        if(argc > (int)sizeof...(U))
+            return JS_ThrowInternalError(ctx, "Bad quickjs function, too many args");
+
+        try
+        {
+            if constexpr(std::is_same_v<R, void>)
+            {
+                func(from_js<std::decay_t<U>>(ctx, (int)Is < argc ? argv[Is] : JS_UNDEFINED)...);
+
+                return JS_UNDEFINED;
+            }
+            else
+            {
+                return args::push(ctx, func(from_js<std::decay_t<U>>(ctx, (int)Is < argc ? argv[Is] : JS_UNDEFINED)...));
+            }
+        }
+        catch(std::runtime_error& err)
+        {
+            const char* str = err.what();
+
+            return JS_ThrowInternalError(ctx, "%s", str);
+        }
+        catch(...)
+        {
+            return JS_ThrowInternalError(ctx, "Unknown C++ exception");
+        }
+    }
+
+    template<typename R, typename... U>
+    inline
+    JSValue fast_call(JSContext* ctx, int argc, JSValueConst* argv, R(*func)(U...))
+    {
+        return fast_call<R, U...>(ctx, argc, argv, func, std::index_sequence_for<U...>());
+    }
+
+    ///binds a plain C++ function, eg int add(int, double), converting each argument directly from argv
+    ///unlike function<> there's no value_context, this stack or value per argument, and the interrupt
+    ///handler isn't polled on entry (it still runs from the interpreter as normal)
+    template<auto func>
+    inline
+    JSValue fast_function(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv)
+    {
+        return fast_call(ctx, argc, argv, func);
+    }
+
+    ///type erased C++ callable owned by a JS function, see make_function
+    template<typename F, typename = void>
+    struct has_gc_mark : std::false_type{};
+
+    template<typename F>
+    struct has_gc_mark<F, std::void_t<decltype(std::declval<F&>().gc_mark((JSRuntime*)nullptr, (JS_MarkFunc*)nullptr))>> : std::true_type{};
+
+    struct callable_base
+    {
+        virtual JSValue invoke(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv) = 0;
+        ///called by the cycle collector, reports every JSValue the callable owns with JS_MarkValue
+        virtual void gc_mark(JSRuntime* rt, JS_MarkFunc* mark_func){}
+        virtual ~callable_base(){}
+    };
+
+    template<typename F, typename R, typename... U>
+    struct callable_impl : callable_base
+    {
+        F func;
+
+        template<typename G>
+        callable_impl(G&& _func) : func(std::forward<G>(_func)){}
+
+        JSValue invoke(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv) override
+        {
+            if constexpr(starts_with_context<U...>())
+                return js_safe_call_decomposed<R, U...>(ctx, this_val, argc, argv, func);
+            else
+                return fast_call<R, U...>(ctx, argc, argv, func, std::index_sequence_for<U...>());
+        }
+
+        void gc_mark(JSRuntime* rt, JS_MarkFunc* mark_func) override
+        {
+            if constexpr(has_gc_mark<F>::value)
+                func.gc_mark(rt, mark_func);
+        }
+    };
+
+    ///takes ownership of callable, which is deleted when the returned function is collected
+    JSValue new_callable_function(JSContext* ctx, callable_base* callable, int length);
+
+    template<typename F, typename R, typename... U>
+    inline
+    value make_function_impl(value_context& vctx, F&& func, std::function<R(U...)>*)
+    {
+        constexpr int length = starts_with_context<U...>() ? (int)sizeof...(U) - 1 : (int)sizeof...(U);
+
+        JSValue fn = new_callable_function(vctx.ctx, new callable_impl<std::decay_t<F>, R, U...>(std::forward<F>(func)), length);
+
+        if(JS_IsException(fn))
+            throw_exception(vctx.ctx, fn);
+
+        value ret(vctx);
+        ret = fn;
+
+        JS_FreeValue(vctx.ctx, fn);
+
+        return ret;
+    }
+
+    ///binds a lambda, std::function or function pointer, with any captured state living as long as the
+    ///JS function does. Parameters follow function<> if the first is a value_context*, otherwise fast_function
+    ///captured values are strong roots the cycle collector can't see into, so a function capturing an object
+    ///that refers back to the function is never collected. A function object can break that by providing
+    ///void gc_mark(JSRuntime*, JS_MarkFunc*) and marking each value it owns
+    template<typename F>
+    inline
+    value make_function(value_context& vctx, F&& func)
+    {
+        using signature = decltype(std::function(func));
+
+        return make_function_impl(vctx, std::forward<F>(func), (signature*)nullptr);
+    }
+
+    ///binds obj->*mfn, the function shares ownership of obj
+    template<typename C, typename R, typename... U>
+    inline
+    value make_function(value_context& vctx, std::shared_ptr<C> obj, R(C::*mfn)(U...))
+    {
+        auto bound = [obj = std::move(obj), mfn](U... args) -> R
+        {
+            return ((*obj).*mfn)(std::forward<U>(args)...);
+        };
+
+        return make_function_impl(vctx, std::move(bound), (std::function<R(U...)>*)nullptr);
+    }
+
+    template<typename C, typename R, typename... U>
+    inline
+    value make_function(value_context& vctx, std::shared_ptr<C> obj, R(C::*mfn)(U...) const)
+    {
+        auto bound = [obj = std::move(obj), mfn](U... args) -> R
+        {
+            return ((*obj).*mfn)(std::forward<U>(args)...);
+        };
+
+        return make_function_impl(vctx, std::move(bound), (std::function<R(U...)>*)nullptr);
+    }
+
+    ///obj must outlive the JS function
+    template<typename C, typename R, typename... U>
+    inline
+    value make_function(value_context& vctx, C* obj, R(C::*mfn)(U...))
+    {
+        auto bound = [obj, mfn](U... args) -> R
+        {
+            return (obj->*mfn)(std::forward<U>(args)...);
+        };
+
+        return make_function_impl(vctx, std::move(bound), (std::function<R(U...)>*)nullptr);
+    }
+
+    template<typename R, typename... U, std::size_t... Is>
+    inline
+    JSValue async_call(JSContext* ctx, int argc, JSValueConst* argv, R(*func)(U...), std::index_sequence<Is...>)
+    {
+        if(argc > (int)sizeof...(U))
+            return JS_ThrowInternalError(ctx, "Bad quickjs function, too many args");
+
+        try
+        {
+            ///arguments are converted here, workers never touch the runtime
+            auto call_args = std::make_tuple(from_js<std::decay_t<U>>(ctx, (int)Is < argc ? argv[Is] : JS_UNDEFINED)...);
+
+            value_context vctx(ctx);
+
+            auto [promise, token] = make_async_promise(vctx);
+
+            auto task = [func, call_args = std::move(call_args), token]() mutable
+            {
+                try
+                {
+                    if constexpr(std::is_same_v<R, void>)
+                    {
+                        std::apply(func, std::move(call_args));
+                        token.resolve();
+                    }
+                    else
+                    {
+                        token.resolve(std::apply(func, std::move(call_args)));
+                    }
+                }
+                catch(std::exception& e)
+                {
+                    token.reject(e.what());
+                }
+                catch(...)
+                {
+                    token.reject("Unknown C++ exception");
+                }
+            };
+
+            ///the promise is already registered as pending, so it has to be settled even if the work never runs
+            try
+            {
+                get_async_pool().submit(std::move(task));
+            }
+            catch(std::exception& e)
+            {
+                token.reject(e.what());
+            }
+            catch(...)
+            {
+                token.reject("Could not queue async call");
+            }
+
+            promise.release();
+
+            return promise.val;
+        }
+        catch(std::runtime_error& err)
+        {
+            const char* str = err.what();
+
+            return JS_ThrowInternalError(ctx, "%s", str);
+        }
+        catch(...)
+        {
+            return JS_ThrowInternalError(ctx, "Unknown C++ exception");
+        }
+    }
+
+    ///binds a plain C++ function (arguments as fast_function) that runs on get_async_pool() and returns a
+    ///promise to script. It settles from value_context::execute_jobs once the work is done
+    template<auto func>
+    inline
+    JSValue async_function(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv)
+    {
+        return async_call(ctx, argc, argv, func, std::make_index_sequence<num_args(func)>());
+    }
+
+    inline
+    JSCFunctionListEntry cfunc_entry(const char* name, int length, funcptr_t func)
+    {
+        JSCFunctionListEntry ret = {};
+        ret.name = name;
+        ret.prop_flags = JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE;
+        ret.def_type = JS_DEF_CFUNC;
+        ret.magic = 0;
+        ret.u.func.length = (uint8_t)length;
+        ret.u.func.cproto = JS_CFUNC_generic;
+        ret.u.func.cfunc.generic = func;
+
+        return ret;
+    }
+
+    ///a function list entry for JS_SetPropertyFunctionList, with the function's name and length set
+    ///eg static const JSCFunctionListEntry natives[] = {js_quickjs::entry<my_native>("my_native"), ...};
+    ///tables must have static storage duration, quickjs keeps pointers into them for lazy initialisation
+    template<auto func>
+    inline
+    JSCFunctionListEntry entry(const char* name)
+    {
+        return cfunc_entry(name, num_args(func), &function<func>);
+    }
+
+    ///as entry, bound through fast_function
+    template<auto func>
+    inline
+    JSCFunctionListEntry fast_entry(const char* name)
+    {
+        return cfunc_entry(name, num_args(func), &fast_function<func>);
+    }
+
+    ///a nested namespace object holding the count entries in tab
+    inline
+    JSCFunctionListEntry object_entry(const char* name, const JSCFunctionListEntry* tab, size_t count)
+    {
+        JSCFunctionListEntry ret = {};
+        ret.name = name;
+        ret.prop_flags = JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE;
+        ret.def_type = JS_DEF_OBJECT;
+        ret.magic = 0;
+        ret.u.prop_list.tab = tab;
+        ret.u.prop_list.len = (int)count;
+
+        return ret;
+    }
+
+    ///defines every entry on obj in one call. Functions are created on first access rather than up front
+    void set_function_list(value& obj, const JSCFunctionListEntry* tab, size_t count);
+    ///set_function_list on the global object
+    void set_global_function_list(value_context& vctx, const JSCFunctionListEntry* tab, size_t count);
+    ///registers a native module exporting each entry. Modules compiled in this context afterwards can import it
+    ///by name directly, no module loader is involved. tab is read lazily and must outlive the context
+    JSModuleDef* new_native_module(value_context& vctx, const char* name, const JSCFunctionListEntry* tab, size_t count);
+
+    ///tables are usually static arrays, these take their size from the array
+    template<size_t N>
+    inline
+    JSCFunctionListEntry object_entry(const char* name, const JSCFunctionListEntry (&tab)[N])
+    {
+        return object_entry(name, tab, N);
+    }
+
+    template<size_t N>
+    inline
+    void set_function_list(value& obj, const JSCFunctionListEntry (&tab)[N])
+    {
+        set_function_list(obj, tab, N);
+    }
+
+    template<size_t N>
+    inline
+    void set_global_function_list(value_context& vctx, const JSCFunctionListEntry (&tab)[N])
+    {
+        set_global_function_list(vctx, tab, N);
+    }
+
+    template<size_t N>
+    inline
+    JSModuleDef* new_native_module(value_context& vctx, const char* name, const JSCFunctionListEntry (&tab)[N])
+    {
+        return new_native_module(vctx, name, tab, N);
+    }
+
     //still need call
 
+    ///registers class_id with the runtime if needed, and gives it a prototype holding methods in this context
+    ///if it doesn't have one yet
+    void define_native_class(JSContext* ctx, JSClassID class_id, const char* name, JSClassFinalizer* finalizer,
+                             const std::pair<const char*, funcptr_t>* methods, size_t method_count);
+    bool is_native_class_defined(JSContext* ctx, JSClassID class_id);
+
+    ///binds T as a JS class. Instances own a heap allocated std::shared_ptr<T> as their opaque, which the
+    ///finalizer deletes, so the C++ object lives as long as either the JS object or any C++ owner does
+    ///methods live on the class prototype, and method<&T::fn> resolves the receiver through its class id
+    ///rather than a property lookup. Call define once per context before pushing instances
+    template<typename T>
+    struct native_class
+    {
+        static JSClassID id()
+        {
+            static JSClassID class_id = []()
+            {
+                JSClassID ret = 0;
+                JS_NewClassID(&ret);
+                return ret;
+            }();
+
+            return class_id;
+        }
+
+        static void define(value_context& vctx, const char* name, std::initializer_list<std::pair<const char*, funcptr_t>> methods = {})
+        {
+            define_native_class(vctx.ctx, id(), name, finalizer, methods.begin(), methods.size());
+        }
+
+        static JSValue wrap(JSContext* ctx, std::shared_ptr<T> obj)
+        {
+            if(!is_native_class_defined(ctx, id()))
+                throw std::runtime_error("native_class used before define");
+
+            JSValue ret = JS_NewObjectClass(ctx, id());
+
+            if(JS_IsException(ret))
+                return ret;
+
+            JS_SetOpaque(ret, new std::shared_ptr<T>(std::move(obj)));
+
+            return ret;
+        }
+
+        ///borrowed, valid while the JS object is alive
+        static T* get(JSValueConst val)
+        {
+            std::shared_ptr<T>* ptr = (std::shared_ptr<T>*)JS_GetOpaque(val, id());
+
+            return ptr ? ptr->get() : nullptr;
+        }
+
+        static std::shared_ptr<T> get_shared(JSValueConst val)
+        {
+            std::shared_ptr<T>* ptr = (std::shared_ptr<T>*)JS_GetOpaque(val, id());
+
+            return ptr ? *ptr : nullptr;
+        }
+
+        template<auto mfn>
+        static JSValue method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv);
+
+    private:
+        static void finalizer(JSRuntime* rt, JSValue val)
+        {
+            delete (std::shared_ptr<T>*)JS_GetOpaque(val, id());
+        }
+    };
+
+    template<auto mfn>
+    struct method_traits;
+
+    ///members take the same arguments as free natives, ie a leading value_context*
+    template<typename R, typename C, typename... U, R(C::*mfn)(value_context*, U...)>
+    struct method_traits<mfn>
+    {
+        static R call(value_context* vctx, U... args)
+        {
+            C* obj = native_class<C>::get(vctx->get_current_this().val);
+
+            if(obj == nullptr)
+                throw std::runtime_error("Method called on an object of the wrong class");
+
+            return (obj->*mfn)(vctx, std::forward<U>(args)...);
+        }
+    };
+
+    template<typename R, typename C, typename... U, R(C::*mfn)(value_context*, U...) const>
+    struct method_traits<mfn>
+    {
+        static R call(value_context* vctx, U... args)
+        {
+            const C* obj = native_class<C>::get(vctx->get_current_this().val);
+
+            if(obj == nullptr)
+                throw std::runtime_error("Method called on an object of the wrong class");
+
+            return (obj->*mfn)(vctx, std::forward<U>(args)...);
+        }
+    };
+
+    template<typename T>
+    template<auto mfn>
+    inline
+    JSValue native_class<T>::method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv)
+    {
+        return js_safe_function_decomposed(ctx, this_val, argc, argv, &method_traits<mfn>::call);
+    }
+
     js_quickjs::value get_global(value_context& vctx);
     void set_global(value_context& vctx, const js_quickjs::value& val);
     js_quickjs::value get_current_function(value_context& vctx);
@@ -848,6 +2361,147 @@ namespace js_quickjs
     value eval(value_context& vctx, const std::string& data, const std::string& name = "test-eval");
     value eval_module(value_context& vctx, const std::string& data, const std::string& name = "test-eval");
     value compile_module(value_context& vctx, const std::string& data, const std::string& name = "test-eval");
+
+    ///bytecode is runtime independent, so one cache can be shared between every context in the process
+    ///entries are evicted least recently used first once max_bytes is exceeded
+    struct bytecode_cache
+    {
+        struct key
+        {
+            size_t hash = 0;
+            size_t source_size = 0;
+            int flags = 0;
+            std::string name;
+
+            bool operator<(const key& other) const
+            {
+                return std::tie(hash, source_size, flags, name) < std::tie(other.hash, other.source_size, other.flags, other.name);
+            }
+        };
+
+        struct stats
+        {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t evictions = 0;
+            size_t bytes = 0;
+            size_t entries = 0;
+        };
+
+        bytecode_cache(size_t _max_bytes);
+
+        static key make_key(const std::string& data, const std::string& name, int flags);
+
+        ///the key is only a hash, so entries keep their source and a hit must match it exactly
+        std::shared_ptr<const std::string> find(const key& k, std::string_view source);
+        ///source counts towards max_bytes alongside the bytecode
+        void insert(const key& k, std::string source, std::string bytecode);
+        void clear();
+
+        stats get_stats();
+
+    private:
+        struct entry
+        {
+            key k;
+            std::string source;
+            std::shared_ptr<const std::string> bytecode;
+
+            size_t size() const
+            {
+                return source.size() + bytecode->size();
+            }
+        };
+
+        std::mutex mut;
+        std::list<entry> lru;
+        std::map<key, std::list<entry>::iterator> lookup;
+        size_t max_bytes = 0;
+        stats cache_stats;
+    };
+
+    std::pair<bool, value> compile(value_context& vctx, bytecode_cache& cache, const std::string& data, const std::string& name);
+    value eval(value_context& vctx, bytecode_cache& cache, const std::string& data, const std::string& name = "test-eval");
+    value compile_module(value_context& vctx, bytecode_cache& cache, const std::string& data, const std::string& name = "test-eval");
+
+    ///inverse of dump_function. Modules are returned resolved, ready for call_compiled
+    value load_function(value_context& vctx, const std::string& bytecode);
+    value load_function(value_context& vctx, const uint8_t* data, size_t size);
+
+    ///file layout, all integers little endian regardless of host and packed in field order:
+    ///header (24 bytes) | index entry (32 bytes) * entry_count | names and bytecode blobs
+    ///entry names are unique
+    ///the checksum is fnv1a-64 over everything after the header
+    ///bytecode is tied to the engine build that produced it, so bundles must be rebuilt alongside quickjs
+    struct bytecode_bundle
+    {
+        static constexpr uint32_t magic = 0x42534a51; ///"QJSB"
+        static constexpr uint32_t version = 1;
+
+        enum kind_t : uint32_t
+        {
+            FUNCTION = 0,
+            MODULE = 1,
+        };
+
+        static constexpr size_t header_size = 24;
+        static constexpr size_t index_entry_size = 32;
+
+        struct header
+        {
+            uint32_t magic = 0;
+            uint32_t version = 0;
+            uint32_t entry_count = 0;
+            uint32_t reserved = 0;
+            uint64_t checksum = 0;
+        };
+
+        struct index_entry
+        {
+            uint32_t kind = 0;
+            uint32_t name_size = 0;
+            uint64_t name_offset = 0;
+            uint64_t data_offset = 0;
+            uint64_t data_size = 0;
+        };
+
+        struct source
+        {
+            std::string name;
+            kind_t kind = FUNCTION;
+            std::string bytecode;
+        };
+
+        struct entry
+        {
+            kind_t kind = FUNCTION;
+            const uint8_t* data = nullptr;
+            size_t size = 0;
+        };
+
+        static std::string write(const std::vector<source>& sources);
+
+        ///maps the file read only. Nothing is copied until load()
+        bytecode_bundle(const std::string& path, bool verify = true);
+        ///does not take ownership, data must outlive the bundle
+        bytecode_bundle(const uint8_t* data, size_t size, bool verify = true);
+        bytecode_bundle(const bytecode_bundle&) = delete;
+        bytecode_bundle& operator=(const bytecode_bundle&) = delete;
+        ~bytecode_bundle();
+
+        bool has(std::string_view name) const;
+        value load(value_context& vctx, std::string_view name) const;
+        std::vector<std::string_view> names() const;
+
+    private:
+        void parse(bool verify);
+        void unmap();
+
+        const uint8_t* mapping = nullptr;
+        size_t mapping_size = 0;
+        bool owns_mapping = false;
+        std::map<std::string_view, entry> index;
+    };
     value xfer_between_contexts(value_context& destination, const value& val);
 
     value make_proxy(value& target, value& handle);
@@ -856,6 +2510,44 @@ namespace js_quickjs
 
     void dump_stack(value_context& vctx);
 
+    ///an ArrayBuffer over memory owned by C++. on_free runs once the engine collects the buffer,
+    ///and must not throw. data must stay valid until then
+    value make_external_buffer(value_context& vctx, uint8_t* data, size_t bytes, std::function<void()> on_free);
+
+    template<typename T>
+    inline
+    value make_external_typed_array(value_context& vctx, T* data, size_t count, std::function<void()> on_free)
+    {
+        constexpr const char* name = typed_array_name<T>();
+
+        static_assert(name != nullptr, "No typed array for this element type");
+
+        value buf = make_external_buffer(vctx, (uint8_t*)data, count * sizeof(T), std::move(on_free));
+
+        JSValue arr = new_typed_array(vctx.ctx, name, JS_DupValue(vctx.ctx, buf.val), count);
+
+        if(JS_IsException(arr))
+            throw_exception(vctx.ctx, arr);
+
+        value ret(vctx);
+        ret = arr;
+
+        JS_FreeValue(vctx.ctx, arr);
+
+        return ret;
+    }
+
+    ///the vector is kept alive for as long as JS can see it
+    template<typename T>
+    inline
+    value make_external_typed_array(value_context& vctx, std::shared_ptr<std::vector<T>> data)
+    {
+        T* ptr = data->data();
+        size_t count = data->size();
+
+        return make_external_typed_array(vctx, ptr, count, [data = std::move(data)](){});
+    }
+
     template<typename T>
     inline
     value make_value(value_context& vctx, const T& t)
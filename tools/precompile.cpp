@@ -0,0 +1,97 @@
+#include "../quickjs_cpp.hpp"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+///usage: precompile output.qjsb [--module] name=path [[--module] name=path ...]
+///--module applies to the entry directly after it
+
+static std::string read_file(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+
+    if(!in.good())
+        throw std::runtime_error("Could not open " + path);
+
+    std::stringstream buf;
+    buf << in.rdbuf();
+
+    return buf.str();
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 3)
+    {
+        std::cout << "usage: " << argv[0] << " output.qjsb [--module] name=path ..." << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        js_quickjs::value_context vctx(nullptr, nullptr);
+
+        std::vector<js_quickjs::bytecode_bundle::source> sources;
+
+        bool next_is_module = false;
+
+        for(int i=2; i < argc; i++)
+        {
+            std::string arg = argv[i];
+
+            if(arg == "--module")
+            {
+                next_is_module = true;
+                continue;
+            }
+
+            size_t split = arg.find('=');
+
+            if(split == std::string::npos)
+                throw std::runtime_error("Expected name=path, got " + arg);
+
+            std::string name = arg.substr(0, split);
+            std::string data = read_file(arg.substr(split + 1));
+
+            js_quickjs::bytecode_bundle::source src;
+            src.name = name;
+
+            if(next_is_module)
+            {
+                js_quickjs::value mod = js_quickjs::compile_module(vctx, data, name);
+
+                src.kind = js_quickjs::bytecode_bundle::MODULE;
+                src.bytecode = js_quickjs::dump_function(mod);
+            }
+            else
+            {
+                auto [success, func] = js_quickjs::compile(vctx, data, name);
+
+                if(!success)
+                    throw std::runtime_error("Could not compile " + name);
+
+                src.kind = js_quickjs::bytecode_bundle::FUNCTION;
+                src.bytecode = js_quickjs::dump_function(func);
+            }
+
+            sources.push_back(src);
+
+            next_is_module = false;
+        }
+
+        std::string bundle = js_quickjs::bytecode_bundle::write(sources);
+
+        std::ofstream out(argv[1], std::ios::binary);
+        out.write(bundle.data(), bundle.size());
+
+        if(!out.good())
+            throw std::runtime_error("Could not write " + std::string(argv[1]));
+    }
+    catch(std::exception& e)
+    {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}